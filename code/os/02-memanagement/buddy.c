@@ -38,7 +38,6 @@ extern uint32_t HEAP_SIZE;
 #define BLOCKSIZE(i)    (1 << (i))
 
 /* the address of the buddy of a block from freelists[i]. */
-typedef unsigned long int	uintptr_t;
 typedef unsigned char uint8_t;
 
 #define _MEMBASE        ((uintptr_t)BUDDY->alloc_begin)
@@ -46,6 +45,10 @@ typedef unsigned char uint8_t;
 #define _BUDDYOF(b, i)  (_OFFSET(b) ^ (1 << (i))) // 将第i位设置位1，即为对应的伙伴块地址（如果有buddy的话）
 #define BUDDYOF(b, i)   ((pointer*)( _BUDDYOF(b, i) + _MEMBASE))
 
+// the order of a block is stored in a header at its start, the size of a
+// pointer so the memory returned is still aligned
+#define HDRSIZE         sizeof(pointer)
+
 // not used yet, for higher order memory alignment
 #define ROUND4(x)       ((x % 4) ? (x / 4 + 1) * 4 : x)
 
@@ -62,8 +65,10 @@ typedef struct pointer{
 
 typedef struct buddy {
   pointer* freelist[MAX_ORDER + 1];  // one more slot for first block in pool
+  int nfree[MAX_ORDER + 1];  // number of blocks in each freelist
   void* alloc_begin;  // 指向堆区开始位置的指针
   uint32_t alloc_size;
+  struct buddy_stats stats;  // kept up to date by bmalloc() and bfree()
 } buddy_t;
 
 
@@ -77,15 +82,17 @@ pointer* bmalloc(int size) {
 
   // calculate minimal order for this size
   i = 0;
-  while (BLOCKSIZE(i) < size + 1) // one more byte for storing order
+  while (BLOCKSIZE(i) < size + HDRSIZE) // the header for storing order
     i++;
 
   order = i = (i < MIN_ORDER) ? MIN_ORDER : i;
 
   // level up until non-null list found
   for (;; i++) {
-    if (i > MAX_ORDER)
+    if (i > MAX_ORDER) {
+      BUDDY->stats.failed++;
       return NULL;
+    }
     if (BUDDY->freelist[i])
       break;
   }
@@ -93,16 +100,25 @@ pointer* bmalloc(int size) {
   // remove the block out of list
   block = BUDDY->freelist[i];
   BUDDY->freelist[i] = BUDDY->freelist[i] -> next;
+  BUDDY->nfree[i]--;
 
   // split until i == order
+  // the lists from order to i - 1 are all empty
   while (i-- > order) {
     buddy = BUDDYOF(block, i);
+    buddy->next = NULL;
     BUDDY->freelist[i] = buddy;
+    BUDDY->nfree[i]++;
   }
 
-  // store order in previous byte
-  *((uint8_t*) (block - 1)) = order;
-  return block;
+  BUDDY->stats.allocs++;
+  BUDDY->stats.free -= BLOCKSIZE(order);
+  if (BUDDY->alloc_size - BUDDY->stats.free > BUDDY->stats.peak)
+    BUDDY->stats.peak = BUDDY->alloc_size - BUDDY->stats.free;
+
+  // store order in the header
+  *((uint8_t*) block) = order;
+  return (pointer*) ((uint8_t*) block + HDRSIZE);
 }
 
 void bfree(pointer* block) {
@@ -111,8 +127,12 @@ void bfree(pointer* block) {
   pointer* buddy;
   pointer** p;
 
-  // fetch order in previous byte
-  i = *((uint8_t*) (block - 1));
+  // fetch order in the header
+  block = (pointer*) ((uint8_t*) block - HDRSIZE);
+  i = *((uint8_t*) block);
+
+  BUDDY->stats.frees++;
+  BUDDY->stats.free += BLOCKSIZE(i);
 
   for (;; i++) {
     // calculate buddy
@@ -127,12 +147,14 @@ void bfree(pointer* block) {
     if (*p != buddy) {
       ((pointer*) block) -> next = BUDDY->freelist[i];
       BUDDY->freelist[i] = block;
+      BUDDY->nfree[i]++;
       return;
     }
     // found, merged block starts from the lower one
     block = (block < buddy) ? block : buddy;
     // remove buddy out of list
     *p = ((pointer*) *p)->next;
+    BUDDY->nfree[i]--;
   }
 }
 
@@ -149,21 +171,35 @@ static int find_largest_power_of_two_less_than(int n) {
 
 void buddy_init() {
 
-  BUDDY = (buddy_t*) HEAP_START;
-  BUDDY->alloc_begin = (void*)BUDDY + sizeof(buddy_t) + 1; // one more byte for storing order
+  int i;
+
+  BUDDY = (buddy_t*) (uintptr_t) HEAP_START;
+  BUDDY->alloc_begin = (void*)BUDDY + sizeof(buddy_t);
   BUDDY->alloc_size = HEAP_SIZE - sizeof(buddy_t);
+  for (i = 0; i <= MAX_ORDER; i++) {
+    BUDDY->freelist[i] = NULL;
+    BUDDY->nfree[i] = 0;
+  }
+  BUDDY->stats = (struct buddy_stats){ 0 };
 
   if(is_power_of_two(BUDDY->alloc_size)){
-    BUDDY->freelist[MAX_ORDER] = (pointer *)BUDDY->alloc_begin;
+    // the whole heap is a single block, of the order of its size
+    i = find_largest_power_of_two_less_than(BUDDY->alloc_size) + 1;
+    BUDDY->freelist[i] = (pointer *)BUDDY->alloc_begin;
+    BUDDY->freelist[i]->next = NULL;
+    BUDDY->nfree[i] = 1;
+    BUDDY->stats.free = BUDDY->alloc_size;
     return;
   }
-  int i;
   // Find the largest block size that is less than or equal to POOLSIZE
   int largest_block_order = find_largest_power_of_two_less_than(BUDDY->alloc_size);
   uint32_t largest_block_size = 1 << largest_block_order;
 
   // Initialize the freelist with the largest block
   BUDDY->freelist[largest_block_order] = (pointer *)BUDDY->alloc_begin;
+  BUDDY->freelist[largest_block_order]->next = NULL;
+  BUDDY->nfree[largest_block_order] = 1;
+  BUDDY->stats.free = largest_block_size;
 
   // Calculate the remaining memory after the largest block is allocated
   uint32_t remaining_memory = BUDDY->alloc_size - largest_block_size;
@@ -175,11 +211,31 @@ void buddy_init() {
       pointer* block = (pointer*)((uintptr_t)(BUDDY->alloc_begin) + (uintptr_t)(BUDDY->alloc_size) - (remaining_memory));
       block->next = NULL;
       BUDDY->freelist[i] = block;
+      BUDDY->nfree[i] = 1;
+      BUDDY->stats.free += current_block_size;
       remaining_memory -= current_block_size;
     }
   }
 }
 
+/*
+ * Get the usage statistics of the buddy allocator, in O(MAX_ORDER), which
+ * is only to find the largest non-empty freelist from the counters.
+ */
+void buddy_stats(struct buddy_stats *stats) {
+
+  int i;
+
+  *stats = BUDDY->stats;
+  stats->largest_order = -1;
+  for (i = MAX_ORDER; i >= 0; i--) {
+    if (BUDDY->nfree[i]) {
+      stats->largest_order = i;
+      break;
+    }
+  }
+}
+
 void buddy_deinit() {
   BUDDY = 0;
 }
@@ -230,6 +286,13 @@ void print_buddy() {
   printf("HEAP start: 0x%08x\n", (unsigned int) (uintptr_t) BUDDY->alloc_begin);
   printf("total free: 0x%08x\n", total_free());
 
+  struct buddy_stats stats;
+  buddy_stats(&stats);
+  printf("free: 0x%08x, peak used: 0x%08x, largest free order: %d\n",
+         stats.free, stats.peak, stats.largest_order);
+  printf("allocs: %d, frees: %d, failed: %d\n",
+         stats.allocs, stats.frees, stats.failed);
+
   for (i = 0; i <= MAX_ORDER; i++) {
     print_list(i);
   }
@@ -0,0 +1,296 @@
+/*
+ * Host-side fuzzing and benchmark harness of the allocators, page.c and
+ * buddy.c of the kernel, built with gcc on Linux, see makefile.
+ *
+ * The allocators are linked as they are, against the simulated heap of
+ * sim.c. The page allocator of 11-syscall is checked by harness_syscall.c.
+ *
+ * Each allocator runs a randomized trace of allocations and frees, and
+ * the invariants are checked after every operation:
+ * - a block lies inside the heap, and doesn't overlap any live block
+ * - the content of a block is intact until it is freed, each block is
+ *   filled with its own pattern
+ * - page_alloc() never fails while there is a free run long enough
+ * - after all the blocks are freed, the whole heap is coalesced again, so
+ *   the largest block allocatable at the beginning is allocatable again
+ * Then the throughput and the fragmentation are reported.
+ *
+ * usage: ./harness [ops] [seed]
+ */
+
+#include "sim.h"
+
+/* page.c */
+extern void page_init(void);
+extern void *page_alloc(int npages);
+extern void page_free(void *p, uint32_t num_pages);
+
+/* buddy.c, struct buddy_stats is the same as in os.h */
+struct buddy_stats {
+	uint32_t free;
+	uint32_t peak;
+	int largest_order;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t failed;
+};
+extern void buddy_init(void);
+extern void *bmalloc(int size);
+extern void bfree(void *block);
+extern void buddy_stats(struct buddy_stats *stats);
+
+/* sample the fragmentation every FRAG_INTERVAL operations */
+#define FRAG_INTERVAL 64
+
+/*
+ * page.c
+ */
+
+static int owner[MAX_PAGES];	/* 1 if the page is allocated */
+
+static uint8_t *page_base(void)
+{
+	return sim_heap + PAGE_RESERVED * PAGE_SIZE;
+}
+
+/* the longest run of free pages, and the number of free pages */
+static int page_largest_free(int npages, int *nfree)
+{
+	int run = 0, largest = 0;
+	*nfree = 0;
+	for (int i = 0; i < npages; i++) {
+		if (owner[i]) {
+			run = 0;
+		} else {
+			(*nfree)++;
+			if (++run > largest) {
+				largest = run;
+			}
+		}
+	}
+	return largest;
+}
+
+static void fuzz_page(long ops)
+{
+	sim_heap_init(SIM_HEAP_SIZE);
+	page_init();
+
+	int npages = SIM_HEAP_SIZE / PAGE_SIZE - PAGE_RESERVED;
+	memset(owner, 0, sizeof(owner));
+
+	uint8_t *p = page_alloc(npages + 1);
+	CHECK(NULL == p, "page_alloc(%d) of %d pages", npages + 1, npages);
+	page_free(p, -1);
+
+	double t = 0;
+	long nops = 0, peak = 0, used = 0, samples = 0;
+	int frag_sum = 0, frag_max = 0;
+
+	for (long op = 0; op < ops; op++) {
+		if (0 == nlive || (nlive < MAX_LIVE && rand() % 100 < 55)) {
+			/* mostly small blocks, sometimes large ones */
+			int n = 1 + rand() % (rand() % 8 ? 8 : 64);
+
+			double start = now();
+			uint8_t *p = page_alloc(n);
+			t += now() - start;
+			nops++;
+
+			if (NULL == p) {
+				int nfree;
+				int largest = page_largest_free(npages, &nfree);
+				CHECK(largest < n, "page_alloc(%d) failed, but "
+				      "%d pages are free in a run", n, largest);
+				continue;
+			}
+
+			long idx = (p - page_base()) / PAGE_SIZE;
+			CHECK(p >= page_base() && 0 == (p - page_base()) % PAGE_SIZE &&
+			      idx + n <= npages,
+			      "page_alloc(%d) = %p out of the heap", n, (void *)p);
+			if (failures) {
+				continue;
+			}
+			for (int i = idx; i < idx + n; i++) {
+				CHECK(!owner[i], "page_alloc(%d) = %p overlaps "
+				      "page %d", n, (void *)p, i);
+				owner[i] = 1;
+			}
+			add_live(p, (size_t)n * PAGE_SIZE);
+			used += n;
+			if (used > peak) {
+				peak = used;
+			}
+		} else {
+			int k = rand() % nlive;
+			struct block *b = &live[k];
+			verify(b);
+
+			double start = now();
+			page_free(b->p, -1);
+			t += now() - start;
+			nops++;
+
+			long idx = (b->p - page_base()) / PAGE_SIZE;
+			int n = b->size / PAGE_SIZE;
+			for (int i = idx; i < idx + n; i++) {
+				owner[i] = 0;
+			}
+			used -= n;
+			del_live(k);
+		}
+
+		if (0 == op % FRAG_INTERVAL) {
+			int nfree;
+			int largest = page_largest_free(npages, &nfree);
+			int frag = nfree ? 100 - largest * 100 / nfree : 0;
+			frag_sum += frag;
+			if (frag > frag_max) {
+				frag_max = frag;
+			}
+			samples++;
+		}
+	}
+
+	while (nlive > 0) {
+		verify(&live[0]);
+		page_free(live[0].p, -1);
+		del_live(0);
+	}
+	memset(owner, 0, sizeof(owner));
+
+	/* all freed, so the whole heap must be a single free run again */
+	p = page_alloc(npages);
+	CHECK(p == page_base(), "page_alloc(%d) of the whole heap = %p",
+	      npages, (void *)p);
+	page_free(p, -1);
+
+	printf("page:  %ld ops, %.0f ops/s, peak %ld of %d pages, "
+	       "fragmentation avg %ld%% max %d%%\n",
+	       nops, nops / t, peak, npages,
+	       samples ? frag_sum / samples : 0, frag_max);
+}
+
+/*
+ * buddy.c
+ */
+
+/* the largest size allocatable, probed by powers of 2 */
+static int buddy_capacity(void)
+{
+	for (int k = 28; k > 4; k--) {
+		int size = (1 << (k - 1)) + 1;
+		void *p = bmalloc(size);
+		if (p) {
+			bfree(p);
+			return size;
+		}
+	}
+	return 0;
+}
+
+static void fuzz_buddy(long ops)
+{
+	/* not a power of 2, so the heap is split into blocks of all sizes */
+	sim_heap_init(SIM_HEAP_SIZE - 3 * PAGE_SIZE - 1234);
+	buddy_init();
+
+	uint8_t *lo = sim_heap;
+	uint8_t *hi = sim_heap + HEAP_SIZE;
+	struct buddy_stats init;
+	buddy_stats(&init);
+	int capacity = buddy_capacity();
+	CHECK(capacity > 0, "bmalloc() fails on an empty heap");
+	CHECK(init.largest_order >= 0 && capacity <= 1 << init.largest_order,
+	      "largest free order %d, but bmalloc(%d) works",
+	      init.largest_order, capacity);
+
+	double t = 0;
+	long nops = 0, nfailed = 0;
+	size_t used = 0, peak = 0;
+
+	for (long op = 0; op < ops; op++) {
+		if (0 == nlive || (nlive < MAX_LIVE && rand() % 100 < 55)) {
+			int size = 1 + rand() % (rand() % 8 ? 256 : 16384);
+
+			double start = now();
+			uint8_t *p = bmalloc(size);
+			t += now() - start;
+			nops++;
+
+			if (NULL == p) {
+				nfailed++;
+				continue;
+			}
+			CHECK(p >= lo && p + size <= hi,
+			      "bmalloc(%d) = %p out of the heap", size, (void *)p);
+			CHECK(0 == (uintptr_t)p % sizeof(void *),
+			      "bmalloc(%d) = %p misaligned", size, (void *)p);
+			CHECK(!overlaps(p, size), "bmalloc(%d) = %p overlaps "
+			      "a live block", size, (void *)p);
+			if (failures) {
+				continue;
+			}
+			add_live(p, size);
+			used += size;
+			if (used > peak) {
+				peak = used;
+			}
+		} else {
+			int k = rand() % nlive;
+			verify(&live[k]);
+
+			double start = now();
+			bfree(live[k].p);
+			t += now() - start;
+			nops++;
+
+			used -= live[k].size;
+			del_live(k);
+		}
+	}
+
+	while (nlive > 0) {
+		verify(&live[0]);
+		bfree(live[0].p);
+		del_live(0);
+	}
+
+	/* all freed, so the buddies must have been merged again */
+	CHECK(buddy_capacity() == capacity,
+	      "bmalloc(%d) fails after all the blocks are freed", capacity);
+
+	struct buddy_stats stats;
+	buddy_stats(&stats);
+	CHECK(stats.free == init.free && stats.largest_order == init.largest_order,
+	      "free %u, largest order %d after all the blocks are freed, "
+	      "was %u, %d", stats.free, stats.largest_order,
+	      init.free, init.largest_order);
+	CHECK(stats.allocs == stats.frees && stats.failed >= nfailed,
+	      "allocs %u, frees %u, failed %u, but %ld bmalloc() failed",
+	      stats.allocs, stats.frees, stats.failed, nfailed);
+
+	printf("buddy: %ld ops, %.0f ops/s, peak %zu of %u bytes requested, "
+	       "%ld failed\n", nops, nops / t, peak, HEAP_SIZE, nfailed);
+}
+
+int main(int argc, char **argv)
+{
+	long ops = argc > 1 ? atol(argv[1]) : 100000;
+	unsigned int seed = argc > 2 ? atoi(argv[2]) : 1;
+
+	printf("ops = %ld, seed = %u\n", ops, seed);
+
+	srand(seed);
+	fuzz_page(ops);
+	srand(seed);
+	fuzz_buddy(ops);
+
+	if (failures) {
+		printf("%d failure(s)\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,542 @@
+/*
+ * Host-side fuzzing harness of the page allocator of 11-syscall, which
+ * the kernel of the later chapters runs on: page_alloc_aligned(), the
+ * references of page_get()/page_put(), the zero pool and page_meminfo().
+ * It is linked as it is, against the simulated heap of sim.c, see
+ * makefile.
+ *
+ * A randomized trace of allocations, aligned or not, and frees is run, and
+ * the invariants are checked after every operation:
+ * - a block lies inside the heap, is aligned as requested, and doesn't
+ *   overlap any live block
+ * - the content of a block is intact until it is freed
+ * - page_alloc() never fails while there is a free run long enough
+ * - a shared page is freed by the last page_put(), not before
+ * - page_meminfo() agrees with the pages the harness holds
+ * Then the zero pool and the corner cases are checked one by one, e.g. an
+ * aligned allocation whose first candidate is taken, or which only fits
+ * once the zero pool is reclaimed.
+ *
+ * usage: ./harness_syscall [ops] [seed]
+ */
+
+#include "sim.h"
+
+/* page.c, struct meminfo is the same as in meminfo.h */
+struct meminfo {
+	uint32_t total;
+	uint32_t free;
+	uint32_t peak;
+	uint32_t largest_free;
+	uint32_t zero_pool;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t failed;
+	uint32_t zero_hits;
+	uint32_t zero_misses;
+};
+extern void page_init(void);
+extern void *page_alloc(int npages);
+extern void page_free(void *p);
+extern void *page_alloc_zeroed(int npages);
+extern void *page_alloc_aligned(int npages, int align_order);
+extern void page_zero_refill(void);
+extern void page_zero_idle(void);
+extern int page_get(void *p);
+extern void page_put(void *p);
+extern int page_shared(void *p);
+extern void page_meminfo(struct meminfo *info);
+
+/* see page.c */
+#define ZERO_POOL_SIZE 8
+#define PAGE_REF_MAX 63
+
+static int npages;
+static struct meminfo base;	/* the counters are kept across page_init() */
+static int owner[MAX_PAGES];	/* 1 if the page is allocated */
+static int refs[MAX_PAGES];	/* extra references of the first page */
+
+static uint8_t *page_base(void)
+{
+	return sim_heap + PAGE_RESERVED * PAGE_SIZE;
+}
+
+static int page_index(uint8_t *p)
+{
+	return (p - page_base()) / PAGE_SIZE;
+}
+
+static uint8_t *page_addr(int i)
+{
+	return page_base() + (size_t)i * PAGE_SIZE;
+}
+
+/* the longest run of free pages, and the number of free pages */
+static int page_largest_free(int *nfree)
+{
+	int run = 0, largest = 0;
+	*nfree = 0;
+	for (int i = 0; i < npages; i++) {
+		if (owner[i]) {
+			run = 0;
+		} else {
+			(*nfree)++;
+			if (++run > largest) {
+				largest = run;
+			}
+		}
+	}
+	return largest;
+}
+
+static void setup(void)
+{
+	sim_heap_init(SIM_HEAP_SIZE);
+	page_init();
+	npages = SIM_HEAP_SIZE / PAGE_SIZE - PAGE_RESERVED;
+	memset(owner, 0, sizeof(owner));
+	memset(refs, 0, sizeof(refs));
+	page_meminfo(&base);
+}
+
+/* check a block just allocated, and take it, return 0 if it is bad */
+static int take(uint8_t *p, int n, int align_order, const char *what)
+{
+	int idx = page_index(p);
+	CHECK(p >= page_base() && 0 == (p - page_base()) % PAGE_SIZE &&
+	      idx + n <= npages,
+	      "%s(%d) = %p out of the heap", what, n, (void *)p);
+	CHECK(0 == (uintptr_t)p % ((uintptr_t)PAGE_SIZE << align_order),
+	      "%s(%d, %d) = %p misaligned", what, n, align_order, (void *)p);
+	if (failures) {
+		return 0;
+	}
+	for (int i = idx; i < idx + n; i++) {
+		CHECK(!owner[i], "%s(%d) = %p overlaps page %d",
+		      what, n, (void *)p, i);
+		owner[i] = 1;
+	}
+	add_live(p, (size_t)n * PAGE_SIZE);
+	return 1;
+}
+
+/* the counters of page_meminfo() against the pages the harness holds */
+static void check_meminfo(uint32_t failed)
+{
+	struct meminfo info;
+	page_meminfo(&info);
+
+	int nfree;
+	int largest = page_largest_free(&nfree);
+	CHECK(info.total == npages && info.free == nfree &&
+	      info.largest_free == largest && 0 == info.zero_pool,
+	      "meminfo total %u, free %u, largest free %u, zero pool %u, "
+	      "but %d pages, %d free, %d in a run",
+	      info.total, info.free, info.largest_free, info.zero_pool,
+	      npages, nfree, largest);
+	CHECK(info.allocs - info.frees == nlive &&
+	      info.failed - base.failed == failed,
+	      "meminfo allocs %u, frees %u, failed %u, but %d live blocks, "
+	      "%u failed", info.allocs, info.frees, info.failed - base.failed,
+	      nlive, failed);
+	CHECK(info.peak >= npages - nfree,
+	      "meminfo peak %u, but %d pages used", info.peak, npages - nfree);
+}
+
+static void fuzz(long ops)
+{
+	setup();
+
+	uint32_t failed = 0;
+	long nshared = 0;
+
+	for (long op = 0; op < ops; op++) {
+		if (0 == nlive || (nlive < MAX_LIVE && rand() % 100 < 55)) {
+			int n = 1 + rand() % (rand() % 8 ? 8 : 64);
+			int align_order = rand() % 4 ? 0 : rand() % 7;
+
+			uint8_t *p = align_order ?
+				page_alloc_aligned(n, align_order) :
+				page_alloc(n);
+
+			if (NULL == p) {
+				failed++;
+				int nfree;
+				int largest = page_largest_free(&nfree);
+				CHECK(align_order || largest < n,
+				      "page_alloc(%d) failed, but "
+				      "%d pages are free in a run", n, largest);
+				check_meminfo(failed);
+				continue;
+			}
+			if (!take(p, n, align_order, align_order ?
+				  "page_alloc_aligned" : "page_alloc")) {
+				continue;
+			}
+
+			/* share some of the single pages */
+			if (1 == n && rand() % 4 == 0) {
+				int idx = page_index(p);
+				refs[idx] = 1 + rand() % 3;
+				for (int k = 0; k < refs[idx]; k++) {
+					CHECK(0 == page_get(p),
+					      "page_get(%p) failed", (void *)p);
+				}
+				CHECK(page_shared(p), "page %p not shared "
+				      "after page_get()", (void *)p);
+				nshared++;
+			}
+		} else {
+			int k = rand() % nlive;
+			struct block *b = &live[k];
+			verify(b);
+
+			int idx = page_index(b->p);
+			int n = b->size / PAGE_SIZE;
+			if (refs[idx]) {
+				/* only the last reference frees the page */
+				struct meminfo before, after;
+				page_meminfo(&before);
+				for (; refs[idx] > 0; refs[idx]--) {
+					page_put(b->p);
+				}
+				page_meminfo(&after);
+				CHECK(!page_shared(b->p) &&
+				      after.free == before.free,
+				      "page %p freed or still shared "
+				      "before the last page_put()", (void *)b->p);
+				page_put(b->p);
+			} else {
+				page_free(b->p);
+			}
+
+			for (int i = idx; i < idx + n; i++) {
+				owner[i] = 0;
+			}
+			del_live(k);
+		}
+		check_meminfo(failed);
+	}
+
+	while (nlive > 0) {
+		verify(&live[0]);
+		page_free(live[0].p);
+		del_live(0);
+	}
+	memset(owner, 0, sizeof(owner));
+	memset(refs, 0, sizeof(refs));
+	check_meminfo(failed);
+
+	/* all freed, so the whole heap must be a single free run again */
+	uint8_t *p = page_alloc(npages);
+	CHECK(p == page_base(), "page_alloc(%d) of the whole heap = %p",
+	      npages, (void *)p);
+	page_free(p);
+
+	printf("fuzz:  %ld ops, %ld shared pages, %u failed\n",
+	       ops, nshared, failed);
+}
+
+/* the sizes out of range are rejected, without touching the heap */
+static void test_bad_size(void)
+{
+	setup();
+
+	int bad[] = { 0, -1, -npages, npages + 1, 0x7fffffff, -0x7fffffff - 1 };
+	for (int k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+		void *p = page_alloc(bad[k]);
+		CHECK(NULL == p, "page_alloc(%d) = %p", bad[k], p);
+		p = page_alloc_aligned(bad[k], 1);
+		CHECK(NULL == p, "page_alloc_aligned(%d, 1) = %p", bad[k], p);
+	}
+	check_meminfo(2 * sizeof(bad) / sizeof(bad[0]));
+
+	uint8_t *p = page_alloc(npages);
+	CHECK(p == page_base(), "page_alloc(%d) of the whole heap = %p",
+	      npages, (void *)p);
+	page_free(p);
+}
+
+static void test_aligned(void)
+{
+	setup();
+	uint32_t failed = 0;
+
+	/* the order is out of range, or larger than the heap */
+	int bad[] = { -1, 20, 31, 19, 11 };
+	for (int k = 0; k < sizeof(bad) / sizeof(bad[0]); k++) {
+		void *p = page_alloc_aligned(1, bad[k]);
+		CHECK(NULL == p, "page_alloc_aligned(1, %d) = %p", bad[k], p);
+		failed++;
+	}
+	check_meminfo(failed);
+
+	/*
+	 * Every page is taken, but for a run of 20 pages from the first one
+	 * after an aligned one, so the first aligned candidate is taken and
+	 * the search must skip to the next one, inside the run.
+	 */
+	int order = 4, align = 1 << order;
+	for (int i = 0; i < npages; i++) {
+		uint8_t *p = page_alloc(1);
+		CHECK(p == page_addr(i), "page_alloc(1) = %p, page %d expected",
+		      (void *)p, i);
+		owner[i] = 1;
+	}
+	int first = page_index((uint8_t *)(((uintptr_t)page_base() +
+			((uintptr_t)PAGE_SIZE << order) - 1) &
+			~(((uintptr_t)PAGE_SIZE << order) - 1)));
+	int start = first + 1, end = start + 20;
+	for (int i = start; i < end; i++) {
+		page_free(page_addr(i));
+		owner[i] = 0;
+	}
+	uint8_t *p = page_alloc_aligned(4, order);
+	CHECK(p == page_addr(first + align),
+	      "page_alloc_aligned(4, %d) = %p, page %d expected",
+	      order, (void *)p, first + align);
+	page_free(p);
+
+	/* a run long enough, but no aligned candidate fits in it */
+	p = page_alloc_aligned(8, order);
+	CHECK(NULL == p, "page_alloc_aligned(8, %d) = %p in a run of %d "
+	      "pages from page %d", order, (void *)p, end - start, start);
+	failed++;
+	p = page_alloc(8);
+	CHECK(p == page_addr(start), "page_alloc(8) = %p, page %d expected",
+	      (void *)p, start);
+	page_free(p);
+
+	for (int i = 0; i < npages; i++) {
+		if (i < start || i >= end) {
+			page_free(page_addr(i));
+		}
+		owner[i] = 0;
+	}
+	check_meminfo(failed);
+
+	/* the largest aligned block in the heap, which is freed as usual */
+	int orders = 0;
+	while (orders < 19 && (2 << orders) <= npages) {
+		orders++;
+	}
+	for (order = orders; order > 0; order--) {
+		p = page_alloc_aligned(1 << order, order);
+		if (p) {
+			break;
+		}
+		failed++;
+	}
+	CHECK(p && take(p, 1 << order, order, "page_alloc_aligned"),
+	      "page_alloc_aligned() fails on an empty heap");
+	if (p) {
+		page_free(p);
+		del_live(0);
+		memset(owner, 0, sizeof(owner));
+	}
+	check_meminfo(failed);
+
+	printf("aligned: largest block %d pages\n", 1 << order);
+}
+
+/*
+ * page_alloc_aligned() searches again once the clean pages of the zero
+ * pool are given back, but never takes the dirty ones the idle task may
+ * be zeroing.
+ */
+static void test_aligned_reclaim(void)
+{
+	setup();
+
+	/* the pool takes the first pages, all the others are allocated */
+	page_zero_refill();
+	struct meminfo info;
+	page_meminfo(&info);
+	int n = info.free;
+	for (int k = 0; k < n; k++) {
+		uint8_t *p = page_alloc(1);
+		CHECK(p == page_addr(ZERO_POOL_SIZE + k),
+		      "page_alloc(1) = %p, page %d expected",
+		      (void *)p, ZERO_POOL_SIZE + k);
+	}
+
+	void *p = page_alloc_aligned(ZERO_POOL_SIZE, 3);
+	CHECK(NULL == p, "page_alloc_aligned(%d, 3) = %p of the dirty pages "
+	      "of the zero pool", ZERO_POOL_SIZE, p);
+
+	page_zero_idle();
+	p = page_alloc_aligned(ZERO_POOL_SIZE, 3);
+	page_meminfo(&info);
+	CHECK(p == page_addr(0) && 0 == info.zero_pool,
+	      "page_alloc_aligned(%d, 3) = %p, zero pool %u, the pages of "
+	      "the pool expected", ZERO_POOL_SIZE, p, info.zero_pool);
+
+	page_free(p);
+	for (int k = 0; k < n; k++) {
+		page_free(page_addr(ZERO_POOL_SIZE + k));
+	}
+	check_meminfo(1);
+}
+
+static void test_refs(void)
+{
+	setup();
+
+	uint8_t *p = page_alloc(1);
+	uint8_t *q = page_alloc(2);
+	CHECK(-1 == page_get(NULL) && -1 == page_get(sim_heap) &&
+	      -1 == page_get(page_addr(npages)) && -1 == page_get(page_addr(3)),
+	      "page_get() of a page not allocated");
+
+	for (int k = 0; k < PAGE_REF_MAX; k++) {
+		CHECK(0 == page_get(p), "page_get() #%d failed", k + 1);
+	}
+	CHECK(-1 == page_get(p), "page_get() over %d references", PAGE_REF_MAX);
+	for (int k = 0; k < PAGE_REF_MAX; k++) {
+		page_put(p);
+		CHECK(PAGE_REF_MAX - 1 == k || page_shared(p),
+		      "page not shared with %d references", PAGE_REF_MAX - 1 - k);
+	}
+	CHECK(!page_shared(p), "page shared with no references");
+
+	struct meminfo info;
+	page_meminfo(&info);
+	CHECK(info.free == npages - 3, "free %u, %d expected",
+	      info.free, npages - 3);
+	page_put(p);
+	page_meminfo(&info);
+	CHECK(info.free == npages - 2 && info.frees - base.frees == 1,
+	      "free %u, frees %u after the last page_put()",
+	      info.free, info.frees - base.frees);
+
+	/* the references don't spill over the next block */
+	CHECK(0 == page_get(q) && page_shared(q) && !page_shared(q + PAGE_SIZE),
+	      "page_get() of the first page of a block");
+	page_put(q);
+	page_put(q);
+	page_meminfo(&info);
+	CHECK(info.free == npages && info.allocs == info.frees,
+	      "free %u, allocs %u, frees %u after all freed",
+	      info.free, info.allocs, info.frees);
+}
+
+static int is_zero(uint8_t *p, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (p[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void test_zero_pool(void)
+{
+	setup();
+
+	/* dirty the whole heap */
+	uint8_t *p = page_alloc(npages);
+	memset(p, 0xa5, (size_t)npages * PAGE_SIZE);
+	page_free(p);
+
+	struct meminfo info;
+	page_zero_refill();
+	page_meminfo(&info);
+	CHECK(ZERO_POOL_SIZE == info.zero_pool &&
+	      info.free == npages - ZERO_POOL_SIZE,
+	      "zero pool %u, free %u after page_zero_refill()",
+	      info.zero_pool, info.free);
+
+	/* the pages are not zeroed yet, so page_alloc_zeroed() misses */
+	p = page_alloc_zeroed(1);
+	CHECK(p && is_zero(p, PAGE_SIZE), "page_alloc_zeroed(1) = %p "
+	      "not zeroed", (void *)p);
+	page_free(p);
+	page_meminfo(&info);
+	CHECK(info.zero_hits == base.zero_hits &&
+	      info.zero_misses - base.zero_misses == 1,
+	      "zero pool hits %u, misses %u, with no page zeroed",
+	      info.zero_hits - base.zero_hits,
+	      info.zero_misses - base.zero_misses);
+
+	page_zero_idle();
+	uint8_t *zeroed[ZERO_POOL_SIZE];
+	for (int k = 0; k < ZERO_POOL_SIZE; k++) {
+		zeroed[k] = page_alloc_zeroed(1);
+		CHECK(zeroed[k] && is_zero(zeroed[k], PAGE_SIZE),
+		      "page_alloc_zeroed(1) = %p from the pool not zeroed",
+		      (void *)zeroed[k]);
+	}
+	page_meminfo(&info);
+	CHECK(info.zero_hits - base.zero_hits == ZERO_POOL_SIZE &&
+	      info.zero_misses - base.zero_misses == 1 &&
+	      0 == info.zero_pool && info.peak >= ZERO_POOL_SIZE,
+	      "zero pool hits %u, misses %u, pool %u, peak %u",
+	      info.zero_hits - base.zero_hits,
+	      info.zero_misses - base.zero_misses, info.zero_pool, info.peak);
+	for (int k = 0; k < ZERO_POOL_SIZE; k++) {
+		page_free(zeroed[k]);
+	}
+
+	/* several pages are zeroed on demand */
+	p = page_alloc(4);
+	memset(p, 0x5a, 4 * PAGE_SIZE);
+	page_free(p);
+	p = page_alloc_zeroed(4);
+	CHECK(p && is_zero(p, 4 * PAGE_SIZE), "page_alloc_zeroed(4) = %p "
+	      "not zeroed", (void *)p);
+	page_free(p);
+
+	/* the clean pages of the pool are given back when memory runs out */
+	page_zero_refill();
+	page_zero_idle();
+	int n = 0;
+	while (page_alloc(1)) {
+		n++;
+	}
+	page_meminfo(&info);
+	CHECK(n == npages && 0 == info.zero_pool && 0 == info.free,
+	      "%d pages allocated of %d, zero pool %u, free %u",
+	      n, npages, info.zero_pool, info.free);
+
+	/* and the pool is not refilled while memory is short */
+	for (int i = 0; i < ZERO_POOL_SIZE; i++) {
+		page_free(page_addr(i));
+	}
+	page_zero_refill();
+	page_meminfo(&info);
+	CHECK(0 == info.zero_pool, "zero pool %u with %u pages free",
+	      info.zero_pool, info.free);
+
+	for (int i = ZERO_POOL_SIZE; i < npages; i++) {
+		page_free(page_addr(i));
+	}
+	page_meminfo(&info);
+	CHECK(info.free == npages && info.largest_free == npages &&
+	      info.allocs == info.frees,
+	      "free %u, largest free %u, allocs %u, frees %u after all freed",
+	      info.free, info.largest_free, info.allocs, info.frees);
+}
+
+int main(int argc, char **argv)
+{
+	long ops = argc > 1 ? atol(argv[1]) : 20000;
+	unsigned int seed = argc > 2 ? atoi(argv[2]) : 1;
+
+	printf("ops = %ld, seed = %u\n", ops, seed);
+
+	test_bad_size();
+	test_aligned();
+	test_aligned_reclaim();
+	test_refs();
+	test_zero_pool();
+	srand(seed);
+	fuzz(ops);
+
+	if (failures) {
+		printf("%d failure(s)\n", failures);
+		return 1;
+	}
+	printf("ok\n");
+	return 0;
+}
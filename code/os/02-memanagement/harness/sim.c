@@ -0,0 +1,96 @@
+/*
+ * The simulated heap: the symbols of mem.S are defined here, and
+ * HEAP_START points to a buffer mapped below 4 GB, since the kernel keeps
+ * addresses in uint32_t.
+ */
+
+#define _GNU_SOURCE
+#include <time.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+
+uint32_t TEXT_START, TEXT_END;
+uint32_t DATA_START, DATA_END;
+uint32_t RODATA_START, RODATA_END;
+uint32_t BSS_START, BSS_END;
+uint32_t HEAP_START;
+uint32_t HEAP_SIZE;
+
+struct block live[MAX_LIVE];
+int nlive;
+static uint8_t next_tag;
+
+int failures;
+
+uint8_t *sim_heap;
+
+void sim_heap_init(uint32_t size)
+{
+	if (NULL == sim_heap) {
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+		flags |= MAP_32BIT;
+#endif
+		sim_heap = mmap((void *)0x40000000, SIM_HEAP_SIZE,
+				PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (MAP_FAILED == sim_heap ||
+		    (uintptr_t)sim_heap + SIM_HEAP_SIZE > UINT32_MAX) {
+			fprintf(stderr, "can not map the heap below 4 GB\n");
+			exit(2);
+		}
+	}
+	memset(sim_heap, 0, SIM_HEAP_SIZE);
+	HEAP_START = (uint32_t)(uintptr_t)sim_heap;
+	HEAP_SIZE = size;
+	nlive = 0;
+}
+
+double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fill(struct block *b)
+{
+	b->tag = ++next_tag;
+	memset(b->p, b->tag, b->size);
+}
+
+void verify(struct block *b)
+{
+	for (size_t i = 0; i < b->size; i++) {
+		if (b->p[i] != b->tag) {
+			CHECK(0, "block %p of %zu bytes corrupted at +%zu",
+			      (void *)b->p, b->size, i);
+			return;
+		}
+	}
+}
+
+/* if [p, p + size) overlaps any live block */
+int overlaps(uint8_t *p, size_t size)
+{
+	for (int i = 0; i < nlive; i++) {
+		if (p < live[i].p + live[i].size && live[i].p < p + size) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void add_live(uint8_t *p, size_t size)
+{
+	struct block *b = &live[nlive++];
+	b->p = p;
+	b->size = size;
+	fill(b);
+}
+
+/* remove the live block i, by moving the last one into its slot */
+void del_live(int i)
+{
+	live[i] = live[--nlive];
+}
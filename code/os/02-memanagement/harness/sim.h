@@ -0,0 +1,63 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+/*
+ * The simulated heap and the bookkeeping of the live blocks, shared by
+ * the harnesses of the page allocators, see sim.c.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* defined in mem.S of the kernel */
+extern uint32_t TEXT_START, TEXT_END;
+extern uint32_t DATA_START, DATA_END;
+extern uint32_t RODATA_START, RODATA_END;
+extern uint32_t BSS_START, BSS_END;
+extern uint32_t HEAP_START;
+extern uint32_t HEAP_SIZE;
+
+#define PAGE_SIZE 4096
+#define PAGE_RESERVED 8		/* pages for the descriptors, see page_init() */
+
+#define SIM_HEAP_SIZE (4 << 20)
+#define MAX_PAGES (SIM_HEAP_SIZE / PAGE_SIZE)
+#define MAX_LIVE 512
+
+struct block {
+	uint8_t *p;
+	size_t size;		/* in bytes */
+	uint8_t tag;		/* the pattern it is filled with */
+};
+
+extern struct block live[MAX_LIVE];
+extern int nlive;
+
+extern int failures;
+
+#define CHECK(cond, ...)						\
+	do {								\
+		if (!(cond)) {						\
+			fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+			fprintf(stderr, __VA_ARGS__);			\
+			fprintf(stderr, "\n");				\
+			if (++failures >= 10) {				\
+				exit(1);				\
+			}						\
+		}							\
+	} while (0)
+
+extern uint8_t *sim_heap;
+
+extern void sim_heap_init(uint32_t size);
+extern double now(void);
+
+extern void fill(struct block *b);
+extern void verify(struct block *b);
+extern int overlaps(uint8_t *p, size_t size);
+extern void add_live(uint8_t *p, size_t size);
+extern void del_live(int i);
+
+#endif /* __SIM_H__ */
@@ -23,4 +23,18 @@ extern void *malloc(size_t size);
 extern void free(void *ptr);
 extern void heap_test();
 
+/*
+ * Usage statistics of the buddy allocator, see buddy_stats().
+ * The sizes are in bytes, including the headers of the blocks.
+ */
+struct buddy_stats {
+	uint32_t free;		/* bytes in the freelists */
+	uint32_t peak;		/* the most bytes ever allocated at a time */
+	int largest_order;	/* of the largest free block, -1 if none */
+	uint32_t allocs;	/* successful bmalloc() */
+	uint32_t frees;		/* bfree() */
+	uint32_t failed;	/* bmalloc() out of memory */
+};
+extern void buddy_stats(struct buddy_stats *stats);
+
 #endif /* __OS_H__ */
@@ -85,7 +85,7 @@ void page_init()
 	_num_pages = (HEAP_SIZE / PAGE_SIZE) - 8;
 	printf("HEAP_START = %x, HEAP_SIZE = %x, num of pages = %d\n", HEAP_START, HEAP_SIZE, _num_pages);
 	
-	struct Page *page = (struct Page *)HEAP_START;
+	struct Page *page = (struct Page *)(uintptr_t)HEAP_START;
 	for (int i = 0; i < _num_pages; i++) {
 		_clear(page);
 		page++;	
@@ -107,9 +107,14 @@ void page_init()
  */
 void *page_alloc(int npages)
 {
+	/* _num_pages is unsigned, (_num_pages - npages) would wrap around */
+	if (npages <= 0 || npages > _num_pages) {
+		return NULL;
+	}
+
 	/* Note we are searching the page descriptor bitmaps. */
 	int found = 0;
-	struct Page *page_i = (struct Page *)HEAP_START;
+	struct Page *page_i = (struct Page *)(uintptr_t)HEAP_START;
 	for (int i = 0; i <= (_num_pages - npages); i++) {
 		if (_is_free(page_i)) {
 			found = 1;
@@ -138,7 +143,7 @@ void *page_alloc(int npages)
 				}
 				page_k--;
 				_set_flag(page_k, PAGE_LAST);	// 所分配的最后一页标记为PAGE_LAST
-				return (void *)(_alloc_start + i * PAGE_SIZE);
+				return (void *)(uintptr_t)(_alloc_start + i * PAGE_SIZE);
 			}
 		}
 		page_i++;
@@ -157,14 +162,14 @@ void page_free(void *p, uint32_t num_pages)
 	/*
 	 * Assert (TBD) if p is invalid
 	 */
-	if (!p || (uint32_t)p >= _alloc_end) {
+	if (!p || (uint32_t)(uintptr_t)p >= _alloc_end) {
 		// 检查输入的指针是否为空 (!p)。如果 p 是 NULL，意味着没有指向有效的内存地址，函数直接返回。
 		// 同时检查 p 的地址是否大于可分配的最大地址，如果大于，则该地址非法，直接返回。
 		return;
 	}
 	/* get the first page descriptor of this memory block */
-	struct Page *page = (struct Page *)HEAP_START;
-	page += ((uint32_t)p - _alloc_start)/ PAGE_SIZE;
+	struct Page *page = (struct Page *)(uintptr_t)HEAP_START;
+	page += ((uint32_t)(uintptr_t)p - _alloc_start)/ PAGE_SIZE;
 	uint32_t page_count = 0;
 	/* loop and clear all the page descriptors of the memory block */
 	while (!_is_free(page) && (page_count < num_pages || num_pages == -1)) {
@@ -182,14 +187,14 @@ void page_free(void *p, uint32_t num_pages)
 void page_test()
 {
 	void *p = page_alloc(2);
-	printf("p = 0x%x\n", p);
+	printf("p = %p\n", p);
 	//page_free(p, -1);
 
 	void *p2 = page_alloc(7);
-	printf("p2 = 0x%x\n", p2);
+	printf("p2 = %p\n", p2);
 	page_free(p2, -1);
 
 	void *p3 = page_alloc(4);
-	printf("p3 = 0x%x\n", p3);
+	printf("p3 = %p\n", p3);
 }
 
@@ -7,11 +7,33 @@
 extern void uart_init(void);
 extern void page_init(void);
 extern void sched_init(void);
+extern void log_init(void);
 extern void schedule(void);
 extern void os_main(void);
 extern void trap_init(void);
 extern void plic_init(void);
 extern void timer_init(void);
+extern void uart_isr(void *arg);
+
+#ifdef CONFIG_BENCH
+/*
+ * Run the microbenchmarks, in Machine mode since they read mcycle, and
+ * before any task, so nothing else is running.
+ * Interrupts are not enabled yet, so the output is flushed by polling
+ * after each one, before it fills up the transmit buffer.
+ */
+static void bench_run(void)
+{
+	printf_bench();
+	uart_flush();
+	mem_bench();
+	uart_flush();
+#ifdef CONFIG_PMP
+	pmp_bench();
+	uart_flush();
+#endif
+}
+#endif
 
 void start_kernel(void)
 {
@@ -23,11 +45,18 @@ void start_kernel(void)
 	trap_init();
 
 	plic_init();
+	request_irq(UART0_IRQ, uart_isr, NULL, 1);
 
 	timer_init();
 
 	sched_init();
 
+	log_init();
+
+#ifdef CONFIG_BENCH
+	bench_run();
+#endif
+
 	os_main();
 
 	schedule();
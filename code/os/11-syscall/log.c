@@ -0,0 +1,152 @@
+#include "os.h"
+
+/*
+ * Kernel log
+ *
+ * klog() formats the message straight into a record of the log buffer of
+ * current hart and returns, it never waits for the UART. Records are sent
+ * to the UART later by the log task, so logging is cheap enough to be used
+ * in hot paths such as trap handlers and the scheduler.
+ *
+ * Each hart has its own buffer, so harts never contend for it. On one hart,
+ * a task may be preempted by a trap handler which logs as well, and tasks
+ * run in User mode which can not disable interrupts, so the buffer is
+ * lock-free in the same way as the transmit buffer of the UART: writers
+ * reserve a record by moving head forward with CAS, fill it, then mark it
+ * ready, the log task reads ready records in order and moves tail forward.
+ * If the buffer is full, the message is dropped and counted, because a
+ * trap handler can not wait for the log task.
+ */
+
+#define LOG_MSG_SIZE	48
+#define LOG_RECORDS	64	/* must be a power of 2 */
+
+struct log_record {
+	uint32_t ready;
+	uint32_t level;
+	uint64_t time;
+	char msg[LOG_MSG_SIZE];
+};
+
+struct log_buf {
+	struct log_record records[LOG_RECORDS];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+};
+
+static struct log_buf log_bufs[MAXNUM_CPU];
+
+/* bumped by klog() for every record, so the log task never misses one */
+static volatile uint32_t log_seq;
+
+/* messages with a level greater than log_level are discarded */
+static int log_level = LOG_DEBUG;
+
+static const char *level_names[] = {
+	[LOG_ERR] = "E",
+	[LOG_WARN] = "W",
+	[LOG_INFO] = "I",
+	[LOG_DEBUG] = "D",
+};
+
+void log_set_level(int level)
+{
+	log_level = level;
+}
+
+/* subsystems whose debug messages are turned on, see pr_debug() */
+uint32_t debug_mask = CONFIG_DEBUG_MASK;
+
+void debug_set_mask(uint32_t mask)
+{
+	debug_mask = mask;
+}
+
+void klog(int level, const char *fmt, ...)
+{
+	if (level > log_level) {
+		return;
+	}
+
+	/*
+	 * klog() is only called in Machine mode, so read the hart id from
+	 * mhartid, tp is not to be trusted after a trap from User mode.
+	 */
+	struct log_buf *lb = &log_bufs[r_mhartid()];
+	uint32_t head = __atomic_load_n(&lb->head, __ATOMIC_RELAXED);
+	do {
+		uint32_t tail = __atomic_load_n(&lb->tail, __ATOMIC_ACQUIRE);
+		if (head - tail >= LOG_RECORDS) {
+			__atomic_fetch_add(&lb->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&lb->head, &head, head + 1, 1,
+					      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	struct log_record *r = &lb->records[head & (LOG_RECORDS - 1)];
+	r->level = level;
+	r->time = get_mtime();
+
+	va_list vl;
+	va_start(vl, fmt);
+	vsnprintf(r->msg, LOG_MSG_SIZE, fmt, vl);
+	va_end(vl);
+
+	__atomic_store_n(&r->ready, 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&log_seq, 1, __ATOMIC_RELEASE);
+	task_wakeup(&log_bufs);
+}
+
+/* send the ready records of one hart to the UART, return how many */
+static int log_drain(int hart)
+{
+	struct log_buf *lb = &log_bufs[hart];
+	int n = 0;
+
+	uint32_t dropped = __atomic_exchange_n(&lb->dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		printf("[hart %d] %d log messages dropped\n", hart, dropped);
+	}
+
+	while (1) {
+		struct log_record *r = &lb->records[lb->tail & (LOG_RECORDS - 1)];
+		if (!__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+
+		/* timestamp in ms since boot */
+		uint32_t rem;
+		uint32_t ms = div_u64_rem(r->time, CLINT_TIMEBASE_FREQ / 1000, &rem);
+		printf("[%d ms] %s: %s\n", ms, level_names[r->level], r->msg);
+
+		r->ready = 0;
+		__atomic_store_n(&lb->tail, lb->tail + 1, __ATOMIC_RELEASE);
+		n++;
+	}
+	return n;
+}
+
+/*
+ * the log task, move records of all the harts to the UART in background,
+ * and block when there is nothing to do, till klog() wakes it up, so the
+ * idle task can run.
+ * It runs in User mode, so it can't disable interrupts around the check,
+ * instead a record logged after log_seq is read is drained right away,
+ * see task_block().
+ */
+static void log_task(void)
+{
+	while (1) {
+		uint32_t seq = __atomic_load_n(&log_seq, __ATOMIC_ACQUIRE);
+		for (int hart = 0; hart < MAXNUM_CPU; hart++) {
+			log_drain(hart);
+		}
+		task_block(&log_bufs, &log_seq, seq);
+	}
+}
+
+void log_init()
+{
+	task_create_kernel(log_task);
+}
@@ -0,0 +1,109 @@
+#include "os.h"
+
+/*
+ * Microbenchmark of the memory library in string.S, against the byte loops
+ * it replaces, print the throughput in bytes per cycle of:
+ * - memset() and memcpy() of buffers of several sizes, aligned on a word
+ *   boundary, and memcpy() with dst misaligned, which is done byte by byte.
+ * - memmove() of overlapping buffers, copied downwards.
+ * It reads mcycle, so must be called in Machine mode, see bench_run().
+ * The output of each size is flushed before the next one, since it may
+ * run before interrupts are enabled.
+ */
+
+#define BENCH_LOOPS 100
+
+static void _byte_set(uint8_t *s, int c, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		s[i] = c;
+	}
+}
+
+static void _byte_copy(uint8_t *dst, const uint8_t *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		dst[i] = src[i];
+	}
+}
+
+/*
+ * print bytes per cycle with 2 decimals, there is no %f.
+ * The 64-bit division goes through div_u64_rem(), since there is no
+ * libgcc to provide __udivdi3.
+ */
+static void _report(const char *name, size_t n, int off, reg_t cycles, reg_t base)
+{
+	uint32_t rem;
+	uint32_t bpc = (uint32_t)div_u64_rem((uint64_t)n * BENCH_LOOPS * 100,
+					     cycles, &rem);
+	uint32_t base_bpc = (uint32_t)div_u64_rem((uint64_t)n * BENCH_LOOPS * 100,
+						  base, &rem);
+
+	printf("mem_bench: %s %d bytes, offset %d: %d.%02d bytes/cycle "
+	       "(byte loop: %d.%02d)\n", name, n, off,
+	       bpc / 100, bpc % 100, base_bpc / 100, base_bpc % 100);
+}
+
+void mem_bench(void)
+{
+	static const size_t sizes[] = { 16, 256, PAGE_SIZE };
+	uint8_t *src = page_alloc(2);
+	uint8_t *dst = page_alloc(2);
+	reg_t start, cycles, base;
+
+	if (NULL == src || NULL == dst) {
+		printf("mem_bench: out of memory\n");
+		goto out;
+	}
+
+	for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		size_t n = sizes[i];
+
+		start = r_mcycle();
+		for (int j = 0; j < BENCH_LOOPS; j++) {
+			memset(dst, j, n);
+		}
+		cycles = r_mcycle() - start;
+		start = r_mcycle();
+		for (int j = 0; j < BENCH_LOOPS; j++) {
+			_byte_set(dst, j, n);
+		}
+		base = r_mcycle() - start;
+		_report("memset", n, 0, cycles, base);
+
+		for (int off = 0; off <= 1; off++) {
+			start = r_mcycle();
+			for (int j = 0; j < BENCH_LOOPS; j++) {
+				memcpy(dst + off, src, n);
+			}
+			cycles = r_mcycle() - start;
+			start = r_mcycle();
+			for (int j = 0; j < BENCH_LOOPS; j++) {
+				_byte_copy(dst + off, src, n);
+			}
+			base = r_mcycle() - start;
+			_report("memcpy", n, off, cycles, base);
+		}
+
+		/* overlapping, a byte loop would have to copy downwards too */
+		start = r_mcycle();
+		for (int j = 0; j < BENCH_LOOPS; j++) {
+			memmove(src + 4, src, n);
+		}
+		cycles = r_mcycle() - start;
+		start = r_mcycle();
+		for (int j = 0; j < BENCH_LOOPS; j++) {
+			for (size_t k = n; k > 0; k--) {
+				src[k + 3] = src[k - 1];
+			}
+		}
+		base = r_mcycle() - start;
+		_report("memmove", n, 4, cycles, base);
+		uart_flush();
+	}
+
+out:
+	page_free(src);
+	page_free(dst);
+}
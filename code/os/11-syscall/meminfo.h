@@ -0,0 +1,24 @@
+#ifndef __MEMINFO_H__
+#define __MEMINFO_H__
+
+#include "types.h"
+
+/*
+ * Usage statistics of the page allocator, shared by the kernel and user
+ * tasks, see page_meminfo() and the meminfo syscall.
+ * All the sizes are in pages.
+ */
+struct meminfo {
+	uint32_t total;		/* pages managed by the allocator */
+	uint32_t free;		/* pages not allocated */
+	uint32_t peak;		/* the most pages ever in use at a time */
+	uint32_t largest_free;	/* the longest run of free pages */
+	uint32_t zero_pool;	/* pages held by the zero pool, not in use */
+	uint32_t allocs;	/* successful page_alloc() */
+	uint32_t frees;		/* page_free() of a block */
+	uint32_t failed;	/* page_alloc() out of memory */
+	uint32_t zero_hits;	/* page_alloc_zeroed() served by the zero pool */
+	uint32_t zero_misses;	/* page_alloc_zeroed() of a page zeroed on demand */
+};
+
+#endif /* __MEMINFO_H__ */
@@ -11,15 +11,114 @@
 /* uart */
 extern int uart_putc(char ch);
 extern void uart_puts(char *s);
+extern void uart_write(const char *s, int len);
+extern int uart_write_nowait(const char *s, int len, int block);
 extern int uart_getc(void);
+extern void uart_flush(void);
+extern int uart_read(char *buf, int n);
+
+/* trap */
+extern int in_trap();
+
+/* memory library, see string.S */
+extern void *memset(void *s, int c, size_t n);
+extern void *memcpy(void *dst, const void *src, size_t n);
+extern void *memmove(void *dst, const void *src, size_t n);
+extern void mem_bench(void);
 
 /* printf */
 extern int  printf(const char* s, ...);
+extern int  snprintf(char *out, size_t n, const char *s, ...);
+extern int  vsnprintf(char *out, size_t n, const char *s, va_list vl);
+extern uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t *rem);
 extern void panic(char *s);
+extern void printf_bench();
+
+/* kernel log */
+#define LOG_ERR		0
+#define LOG_WARN	1
+#define LOG_INFO	2
+#define LOG_DEBUG	3
+
+extern void klog(int level, const char *fmt, ...);
+extern void log_set_level(int level);
+
+/*
+ * Messages with a level greater than CONFIG_LOG_LEVEL are compiled away,
+ * debug messages are compiled in only for the subsystems in
+ * CONFIG_DEBUG_MASK, see DEBUG in Makefile. In debug builds, debug messages
+ * of each subsystem can also be turned on/off at runtime with
+ * debug_set_mask(), and the level lowered with log_set_level(), e.g. by
+ * the debug and loglevel commands of the console, see user_task2().
+ */
+#ifndef CONFIG_LOG_LEVEL
+#define CONFIG_LOG_LEVEL LOG_INFO
+#endif
+#ifndef CONFIG_DEBUG_MASK
+#define CONFIG_DEBUG_MASK 0
+#endif
+
+/* subsystems for debug messages */
+#define DBG_TRAP	(1 << 0)
+#define DBG_IRQ		(1 << 1)
+#define DBG_TIMER	(1 << 2)
+#define DBG_SYSCALL	(1 << 3)
+#define DBG_SCHED	(1 << 4)
+
+extern uint32_t debug_mask;
+extern void debug_set_mask(uint32_t mask);
+
+#define pr_err(fmt, ...) \
+	do { \
+		if (CONFIG_LOG_LEVEL >= LOG_ERR) \
+			klog(LOG_ERR, fmt, ##__VA_ARGS__); \
+	} while (0)
+#define pr_warn(fmt, ...) \
+	do { \
+		if (CONFIG_LOG_LEVEL >= LOG_WARN) \
+			klog(LOG_WARN, fmt, ##__VA_ARGS__); \
+	} while (0)
+#define pr_info(fmt, ...) \
+	do { \
+		if (CONFIG_LOG_LEVEL >= LOG_INFO) \
+			klog(LOG_INFO, fmt, ##__VA_ARGS__); \
+	} while (0)
+#define pr_debug(sys, fmt, ...) \
+	do { \
+		if (CONFIG_LOG_LEVEL >= LOG_DEBUG && \
+		    (CONFIG_DEBUG_MASK & (sys)) && (debug_mask & (sys))) \
+			klog(LOG_DEBUG, fmt, ##__VA_ARGS__); \
+	} while (0)
 
 /* memory management */
+#define PAGE_SIZE 4096
+#define PAGE_ORDER 12
+
 extern void *page_alloc(int npages);
 extern void page_free(void *p);
+extern void *page_alloc_zeroed(int npages);
+extern void *page_alloc_aligned(int npages, int align_order);
+extern void page_zero_refill(void);
+extern void page_zero_idle(void);
+extern int page_get(void *p);
+extern void page_put(void *p);
+extern int page_shared(void *p);
+struct meminfo;
+extern void page_meminfo(struct meminfo *info);
+extern void page_report(void);
+
+/* virtual memory */
+extern pagetable_t uvm_create(void);
+extern void uvm_free(pagetable_t pt);
+extern pte_t *uvm_walk(pagetable_t pt, reg_t va, int alloc);
+extern int uvm_map(pagetable_t pt, reg_t va, reg_t pa, reg_t size, int perm);
+extern reg_t uvm_translate(pagetable_t pt, reg_t va, int perm);
+extern void *uvm_ptr(pagetable_t pt, reg_t va, size_t n, int write);
+extern int uvm_reserve(pagetable_t pt, reg_t va, reg_t size, int perm);
+extern int uvm_fault(pagetable_t pt, reg_t va, int write);
+extern int uvm_share(pagetable_t src, pagetable_t dst, reg_t va, reg_t size);
+extern size_t uvm_copyout(pagetable_t pt, reg_t dstva, const void *src, size_t n);
+extern size_t uvm_copyin(pagetable_t pt, void *dst, reg_t srcva, size_t n);
 
 /* task management */
 struct context {
@@ -62,12 +161,48 @@ struct context {
 };
 
 extern int  task_create(void (*task)(void));
+extern int  task_create_kernel(void (*task)(void));
+extern int  task_access_ok(reg_t addr, size_t n, int write);
+extern pagetable_t task_pagetable();
+extern pagetable_t task_pagetable_of(int id);
+extern int  task_fork();
+extern int  task_page_fault(reg_t va, int write);
 extern void task_delay(volatile int count);
 extern void task_yield();
+extern void task_sleep(void *chan);
+extern void task_wakeup(void *chan);
+extern void task_sleep_until(uint64_t time);
+extern void task_block(void *chan, volatile uint32_t *seq, uint32_t seen);
+extern void task_exit();
+extern int  task_getpid();
+#ifdef CONFIG_STACK_PAINT
+extern void stack_report();
+#endif
+#ifdef CONFIG_PMP
+extern void pmp_bench();
+#endif
 
 /* plic */
 extern int plic_claim(void);
 extern void plic_complete(int irq);
+extern int plic_get_priority(int irq);
+extern int plic_get_threshold(void);
+extern void plic_set_threshold(int threshold);
+extern int request_irq(int irq, void (*handler)(void *arg), void *arg, int priority);
+extern void free_irq(int irq);
+extern int irq_dispatch(int irq);
+extern void irq_report(void);
+
+/* syscall */
+extern void syscall_report(void);
+#define VERIFY_READ	0
+#define VERIFY_WRITE	1
+extern int access_ok(int type, const void *addr, size_t n);
+extern size_t copy_to_user(void *dst, const void *src, size_t n);
+extern size_t copy_from_user(void *dst, const void *src, size_t n);
+extern void *user_ptr(int type, void *addr, size_t n);
+extern void ring_timeout_check(void);
+extern void ring_task_exit(int id);
 
 /* lock */
 extern int spin_lock(void);
@@ -81,5 +216,21 @@ struct timer {
 };
 extern struct timer *timer_create(void (*handler)(void *arg), void *arg, uint32_t timeout);
 extern void timer_delete(struct timer *timer);
+extern uint64_t get_mtime(void);
+
+/* trace, keep the event ids in sync with trace2json.py */
+#define TRACE_SCHEDULE		1	/* arg0: current task */
+#define TRACE_SWITCH_TO		2	/* arg0: next task, -1 for idle */
+#define TRACE_TRAP_ENTER	3	/* arg0: mcause, arg1: mepc */
+#define TRACE_TRAP_EXIT		4	/* arg0: mcause, arg1: return pc */
+#define TRACE_TIMER_CHECK	5	/* arg0: tick, arg1: timers fired */
+#define TRACE_SYSCALL_ENTER	6	/* arg0: syscall no, arg1: a0 */
+#define TRACE_SYSCALL_EXIT	7	/* arg0: syscall no, arg1: return value */
+
+#ifdef CONFIG_TRACE
+extern void trace_event(int id, reg_t arg0, reg_t arg1);
+#else
+#define trace_event(id, arg0, arg1)
+#endif
 
 #endif /* __OS_H__ */
@@ -1,4 +1,5 @@
 #include "os.h"
+#include "meminfo.h"
 
 /*
  * Following global vars are defined in mem.S
@@ -23,17 +24,31 @@ static uint32_t _alloc_start = 0;
 static uint32_t _alloc_end = 0;
 static uint32_t _num_pages = 0;
 
-#define PAGE_SIZE 4096
-#define PAGE_ORDER 12
+/*
+ * Usage statistics, the counters are kept up to date by page_alloc() and
+ * page_free() at no cost, except largest_free, which takes a scan of all
+ * the page descriptors, so it is only computed by page_meminfo() when the
+ * allocator has been used since the last time.
+ * The pages held by the zero pool are counted in zero_pool, not as used
+ * pages, nor in allocs and frees, until page_alloc_zeroed() hands them out.
+ */
+static struct meminfo _stats;
+static int _largest_stale = 1;
+
+static int _zero_reclaim(void);
 
 #define PAGE_TAKEN (uint8_t)(1 << 0)
 #define PAGE_LAST  (uint8_t)(1 << 1)
+#define PAGE_REF_SHIFT 2
+#define PAGE_REF_MAX 63
 
 /*
  * Page Descriptor 
  * flags:
  * - bit 0: flag if this page is taken(allocated)
  * - bit 1: flag if this page is the last page of the memory block allocated
+ * - bit 2 ~ 7: number of extra references to a single page which is shared,
+ *   see page_get()
  */
 struct Page {
 	uint8_t flags;
@@ -85,11 +100,9 @@ void page_init()
 	_num_pages = (HEAP_SIZE / PAGE_SIZE) - 8;
 	printf("HEAP_START = %x, HEAP_SIZE = %x, num of pages = %d\n", HEAP_START, HEAP_SIZE, _num_pages);
 	
-	struct Page *page = (struct Page *)HEAP_START;
-	for (int i = 0; i < _num_pages; i++) {
-		_clear(page);
-		page++;	
-	}
+	memset((void *)(uintptr_t)HEAP_START, 0, _num_pages * sizeof(struct Page));
+
+	_stats.total = _stats.free = _num_pages;
 
 	_alloc_start = _align_page(HEAP_START + 8 * PAGE_SIZE);
 	_alloc_end = _alloc_start + (PAGE_SIZE * _num_pages);
@@ -102,14 +115,57 @@ void page_init()
 }
 
 /*
- * Allocate a memory block which is composed of contiguous physical pages
- * - npages: the number of PAGE_SIZE pages to allocate
+ * take the npages free pages from index i as a memory block, take
+ * housekeeping, then return the actual start address of the block.
  */
-void *page_alloc(int npages)
+static void *_take(int i, int npages)
+{
+	struct Page *page = (struct Page *)(uintptr_t)HEAP_START + i;
+	for (int k = i; k < (i + npages); k++) {
+		_set_flag(page, PAGE_TAKEN);
+		page++;
+	}
+	page--;
+	_set_flag(page, PAGE_LAST);
+
+	_stats.free -= npages;
+	_largest_stale = 1;
+	return (void *)(uintptr_t)(_alloc_start + i * PAGE_SIZE);
+}
+
+/*
+ * count the block p handed out to the caller in the statistics, or a
+ * failed allocation if p is NULL, then return p.
+ */
+static void *_count_alloc(void *p)
+{
+	if (NULL == p) {
+		_stats.failed++;
+		return NULL;
+	}
+	_stats.allocs++;
+	uint32_t used = _stats.total - _stats.free - _stats.zero_pool;
+	if (used > _stats.peak) {
+		_stats.peak = used;
+	}
+	return p;
+}
+
+/*
+ * find npages contiguous free pages and take them, the pages of the zero
+ * pool are reclaimed if there are not enough, not counted in the
+ * statistics.
+ */
+static void *_alloc(int npages)
 {
+	/* _num_pages is unsigned, (_num_pages - npages) would wrap around */
+	if (npages <= 0 || npages > _num_pages) {
+		return NULL;
+	}
+
 	/* Note we are searching the page descriptor bitmaps. */
 	int found = 0;
-	struct Page *page_i = (struct Page *)HEAP_START;
+	struct Page *page_i = (struct Page *)(uintptr_t)HEAP_START;
 	for (int i = 0; i <= (_num_pages - npages); i++) {
 		if (_is_free(page_i)) {
 			found = 1;
@@ -126,43 +182,99 @@ void *page_alloc(int npages)
 				page_j++;
 			}
 			/*
-			 * get a memory block which is good enough for us,
-			 * take housekeeping, then return the actual start
-			 * address of the first page of this memory block
+			 * get a memory block which is good enough for us
 			 */
 			if (found) {
-				struct Page *page_k = page_i;
-				for (int k = i; k < (i + npages); k++) {
-					_set_flag(page_k, PAGE_TAKEN);
-					page_k++;
-				}
-				page_k--;
-				_set_flag(page_k, PAGE_LAST);
-				return (void *)(_alloc_start + i * PAGE_SIZE);
+				return _take(i, npages);
 			}
 		}
 		page_i++;
 	}
+	if (_zero_reclaim()) {
+		return _alloc(npages);
+	}
 	return NULL;
 }
 
 /*
- * Free the memory block
- * - p: start address of the memory block
+ * Allocate a memory block which is composed of contiguous physical pages
+ * - npages: the number of PAGE_SIZE pages to allocate
  */
-void page_free(void *p)
+void *page_alloc(int npages)
+{
+	return _count_alloc(_alloc(npages));
+}
+
+/*
+ * the first index from i of a page aligned on a boundary of align pages,
+ * in physical address, since _alloc_start is only page-aligned.
+ */
+static inline int _align_index(int i, uint32_t align)
+{
+	uint32_t base = _alloc_start >> PAGE_ORDER;
+	return ((base + i + align - 1) & ~(align - 1)) - base;
+}
+
+/*
+ * DESCRIPTION
+ * 	Allocate a memory block of npages contiguous physical pages, whose
+ * 	address is aligned on a boundary of (PAGE_SIZE << align_order) bytes,
+ * 	e.g. align_order 4 for 64 KB, or 10 for a 4 MB Sv32 megapage.
+ * 	Only the aligned candidates are checked, from the end of the block,
+ * 	so once a taken page is met, the search skips to the first aligned
+ * 	candidate after it, rather than over-allocating and trimming.
+ * 	It is freed by page_free() as usual.
+ * RETURN VALUE
+ * 	the address of the block, or NULL if out of memory.
+ */
+void *page_alloc_aligned(int npages, int align_order)
+{
+	if (npages <= 0 || npages > _num_pages ||
+	    align_order < 0 || align_order > 31 - PAGE_ORDER) {
+		return _count_alloc(NULL);
+	}
+
+	uint32_t align = 1 << align_order;
+	struct Page *pages = (struct Page *)(uintptr_t)HEAP_START;
+	int i = _align_index(0, align);
+	while (i + npages <= _num_pages) {
+		int j = i + npages - 1;
+		while (j >= i && _is_free(&pages[j])) {
+			j--;
+		}
+		if (j < i) {
+			return _count_alloc(_take(i, npages));
+		}
+		/* page j is taken, no block from i up to j fits */
+		i = _align_index(j + 1, align);
+	}
+	if (_zero_reclaim()) {
+		return page_alloc_aligned(npages, align_order);
+	}
+	return _count_alloc(NULL);
+}
+
+/*
+ * free the memory block p, not counted in the statistics, return 0 if p is
+ * not an allocated block.
+ */
+static int _free(void *p)
 {
 	/*
 	 * Assert (TBD) if p is invalid
 	 */
-	if (!p || (uint32_t)p >= _alloc_end) {
-		return;
+	if (!p || (uint32_t)(uintptr_t)p >= _alloc_end) {
+		return 0;
 	}
 	/* get the first page descriptor of this memory block */
-	struct Page *page = (struct Page *)HEAP_START;
-	page += ((uint32_t)p - _alloc_start)/ PAGE_SIZE;
+	struct Page *page = (struct Page *)(uintptr_t)HEAP_START;
+	page += ((uint32_t)(uintptr_t)p - _alloc_start)/ PAGE_SIZE;
+	if (_is_free(page)) {
+		return 0;
+	}
 	/* loop and clear all the page descriptors of the memory block */
 	while (!_is_free(page)) {
+		_stats.free++;
 		if (_is_last(page)) {
 			_clear(page);
 			break;
@@ -171,19 +283,259 @@ void page_free(void *p)
 			page++;;
 		}
 	}
+	_largest_stale = 1;
+	return 1;
+}
+
+/*
+ * Free the memory block
+ * - p: start address of the memory block
+ */
+void page_free(void *p)
+{
+	if (_free(p)) {
+		_stats.frees++;
+	}
+}
+
+/*
+ * Pool of pages zeroed in advance by the idle task, for page_alloc_zeroed().
+ *
+ * Each slot goes round EMPTY -> DIRTY -> CLEAN -> EMPTY:
+ * - the kernel fills the EMPTY slots with pages just allocated, before
+ *   switching to the idle task, see page_zero_refill(), and takes the page
+ *   of a CLEAN slot in page_alloc_zeroed().
+ * - the idle task zeroes the pages of the DIRTY slots, see page_zero_idle().
+ * The kernel never touches a DIRTY slot, which the idle task may be zeroing
+ * when it is interrupted, and the idle task never touches the other ones,
+ * so no lock is needed though the idle task is preemptible.
+ *
+ * The pool doesn't hold on to memory the tasks need: it is only refilled
+ * while more than ZERO_POOL_SIZE pages are free, and the pages of the CLEAN
+ * slots are given back when an allocation would fail, see _zero_reclaim().
+ */
+#define ZERO_POOL_SIZE 8
+
+#define ZERO_EMPTY 0
+#define ZERO_DIRTY 1
+#define ZERO_CLEAN 2
+
+struct zero_slot {
+	volatile int state;
+	void *page;
+};
+
+static struct zero_slot zero_pool[ZERO_POOL_SIZE];
+
+/*
+ * DESCRIPTION
+ * 	Allocate npages zeroed pages, a single page is taken from the pool
+ * 	zeroed by the idle task if possible, so it costs no more than
+ * 	page_alloc().
+ * RETURN VALUE
+ * 	the address of the first page, or NULL if out of memory.
+ */
+void *page_alloc_zeroed(int npages)
+{
+	if (1 == npages) {
+		for (int i = 0; i < ZERO_POOL_SIZE; i++) {
+			struct zero_slot *slot = &zero_pool[i];
+			if (ZERO_CLEAN == slot->state) {
+				slot->state = ZERO_EMPTY;
+				_stats.zero_pool--;
+				_stats.zero_hits++;
+				return _count_alloc(slot->page);
+			}
+		}
+		_stats.zero_misses++;
+	}
+
+	void *p = page_alloc(npages);
+	if (p) {
+		memset(p, 0, npages * PAGE_SIZE);
+	}
+	return p;
+}
+
+/*
+ * DESCRIPTION
+ * 	Fill the empty slots of the zero pool with pages to be zeroed, called
+ * 	by the scheduler before it switches to the idle task.
+ */
+void page_zero_refill(void)
+{
+	for (int i = 0; i < ZERO_POOL_SIZE; i++) {
+		struct zero_slot *slot = &zero_pool[i];
+		if (ZERO_EMPTY == slot->state) {
+			if (_stats.free <= ZERO_POOL_SIZE) {
+				return;
+			}
+			slot->page = _alloc(1);
+			if (NULL == slot->page) {
+				return;
+			}
+			_stats.zero_pool++;
+			__sync_synchronize();
+			slot->state = ZERO_DIRTY;
+		}
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Zero the pages of the dirty slots of the zero pool, called by the idle
+ * 	task, in User mode, with access to the whole memory.
+ */
+void page_zero_idle(void)
+{
+	for (int i = 0; i < ZERO_POOL_SIZE; i++) {
+		struct zero_slot *slot = &zero_pool[i];
+		if (ZERO_DIRTY == slot->state) {
+			memset(slot->page, 0, PAGE_SIZE);
+			/* the kernel must not see CLEAN before the zeroes */
+			__sync_synchronize();
+			slot->state = ZERO_CLEAN;
+		}
+	}
+}
+
+/*
+ * free the pages of the CLEAN slots of the zero pool, the DIRTY ones are
+ * left to the idle task, return how many pages are freed.
+ */
+static int _zero_reclaim(void)
+{
+	int n = 0;
+	for (int i = 0; i < ZERO_POOL_SIZE; i++) {
+		struct zero_slot *slot = &zero_pool[i];
+		if (ZERO_CLEAN == slot->state) {
+			slot->state = ZERO_EMPTY;
+			_free(slot->page);
+			_stats.zero_pool--;
+			n++;
+		}
+	}
+	return n;
+}
+
+static struct Page *_page_of(void *p)
+{
+	if ((uint32_t)(uintptr_t)p < _alloc_start || (uint32_t)(uintptr_t)p >= _alloc_end) {
+		return NULL;
+	}
+	return (struct Page *)(uintptr_t)HEAP_START + ((uint32_t)(uintptr_t)p - _alloc_start) / PAGE_SIZE;
+}
+
+static inline int _refs(struct Page *page)
+{
+	return page->flags >> PAGE_REF_SHIFT;
+}
+
+/*
+ * DESCRIPTION
+ * 	Take one more reference to the single page p, for sharing it (e.g.
+ * 	copy-on-write). Each reference is dropped by page_put().
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: p is not an allocated page, or it has too many references
+ */
+int page_get(void *p)
+{
+	struct Page *page = _page_of(p);
+	if (NULL == page || _is_free(page) || _refs(page) >= PAGE_REF_MAX) {
+		return -1;
+	}
+	page->flags += 1 << PAGE_REF_SHIFT;
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Drop a reference to the single page p, which is freed when the last
+ * 	reference is dropped.
+ */
+void page_put(void *p)
+{
+	struct Page *page = _page_of(p);
+	if (NULL == page || _is_free(page)) {
+		return;
+	}
+	if (_refs(page)) {
+		page->flags -= 1 << PAGE_REF_SHIFT;
+	} else {
+		page_free(p);
+	}
+}
+
+/*
+ * RETURN VALUE
+ * 	1 if the page p is shared, i.e. referenced more than once.
+ */
+int page_shared(void *p)
+{
+	struct Page *page = _page_of(p);
+	return page && _refs(page);
+}
+
+/*
+ * DESCRIPTION
+ * 	Get the usage statistics of the page allocator.
+ */
+void page_meminfo(struct meminfo *info)
+{
+	if (_largest_stale) {
+		struct Page *page = (struct Page *)(uintptr_t)HEAP_START;
+		uint32_t run = 0;
+		_stats.largest_free = 0;
+		for (int i = 0; i < _num_pages; i++, page++) {
+			run = _is_free(page) ? run + 1 : 0;
+			if (run > _stats.largest_free) {
+				_stats.largest_free = run;
+			}
+		}
+		_largest_stale = 0;
+	}
+
+	*info = _stats;
+}
+
+/*
+ * DESCRIPTION
+ * 	Print the usage statistics of the page allocator, fragmentation is
+ * 	the percentage of the free pages out of the largest free run, that
+ * 	is, which can not be allocated at a time.
+ */
+void page_report(void)
+{
+	struct meminfo info;
+	page_meminfo(&info);
+
+	printf("pages: total = %d, free = %d, peak used = %d, zero pool = %d\n",
+	       info.total, info.free, info.peak, info.zero_pool);
+	printf("       largest free = %d, fragmentation = %d%%\n",
+	       info.largest_free,
+	       info.free ? 100 - info.largest_free * 100 / info.free : 0);
+	printf("       allocs = %d, frees = %d, failed = %d\n",
+	       info.allocs, info.frees, info.failed);
+	printf("       zero pool hits = %d, misses = %d\n",
+	       info.zero_hits, info.zero_misses);
 }
 
 void page_test()
 {
 	void *p = page_alloc(2);
-	printf("p = 0x%x\n", p);
+	printf("p = %p\n", p);
 	//page_free(p);
 
 	void *p2 = page_alloc(7);
-	printf("p2 = 0x%x\n", p2);
+	printf("p2 = %p\n", p2);
 	page_free(p2);
 
 	void *p3 = page_alloc(4);
-	printf("p3 = 0x%x\n", p3);
+	printf("p3 = %p\n", p3);
+
+	void *p4 = page_alloc_aligned(3, 4);
+	printf("p4 = %p, aligned on 64 KB\n", p4);
+	page_free(p4);
 }
 
@@ -12,6 +12,21 @@
  */
 #define MAXNUM_CPU 8
 
+/*
+ * size of each hart's stack, see start.S.
+ * Each hart boots on this stack, and once tasks are running, the same stack
+ * is reused as the interrupt stack of the hart, so that trap handlers don't
+ * run on the stack of the interrupted task.
+ */
+#define HART_STACK_SIZE 1024
+
+/*
+ * Stacks are painted with this pattern before being used, so we can find
+ * out the high-water mark of each stack by searching for the first word
+ * which has been overwritten.
+ */
+#define STACK_PAINT_PATTERN 0xdeadbeef
+
 /*
  * MemoryMap
  * see https://github.com/qemu/qemu/blob/master/hw/riscv/virt.c, virt_memmap[]
@@ -52,6 +67,7 @@
  * #define VIRT_PLIC_SIZE(__num_context) \
  *     (VIRT_PLIC_CONTEXT_BASE + (__num_context) * VIRT_PLIC_CONTEXT_STRIDE)
  */
+#define PLIC_NUM_SOURCES 127
 #define PLIC_BASE 0x0c000000L
 #define PLIC_PRIORITY(id) (PLIC_BASE + (id) * 4)
 #define PLIC_PENDING(id) (PLIC_BASE + 0x1000 + ((id) / 32) * 4)
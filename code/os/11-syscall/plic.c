@@ -1,11 +1,33 @@
 #include "os.h"
 
+/*
+ * Durations of handlers are counted in a histogram with a log2 scale of
+ * ticks of mtime: bucket i holds the handlers taking [2^i, 2^(i+1)) ticks,
+ * except that bucket 0 also holds 0 tick and the last bucket holds all the
+ * longer ones.
+ */
+#define IRQ_HIST_BUCKETS 16
+
+/*
+ * IRQ descriptor, the dispatch table is indexed by the interrupt ID.
+ * ID 0 is reserved to mean "no interrupt".
+ */
+struct irq_desc {
+	void (*handler)(void *arg);
+	void *arg;
+	uint32_t count;
+	uint32_t hist[IRQ_HIST_BUCKETS];
+};
+
+static struct irq_desc irq_table[PLIC_NUM_SOURCES + 1];
+
 void plic_init(void)
 {
-	int hart = r_tp();
-  
-	/* 
-	 * Set priority for UART0.
+	int hart = r_mhartid();
+
+	/*
+	 * Each interrupt source is enabled when its handler is registered by
+	 * request_irq(), so nothing but the threshold is set here.
 	 *
 	 * Each PLIC interrupt source can be assigned a priority by writing 
 	 * to its 32-bit memory-mapped priority register.
@@ -17,18 +39,9 @@ void plic_init(void)
 	 * the Interrupt ID; interrupts with the lowest ID have the highest 
 	 * effective priority.
 	 */
-	*(uint32_t*)PLIC_PRIORITY(UART0_IRQ) = 1;
- 
-	/*
-	 * Enable UART0
-	 *
-	 * Each global interrupt can be enabled by setting the corresponding 
-	 * bit in the enables registers.
-	 */
-	*(uint32_t*)PLIC_MENABLE(hart, UART0_IRQ)= (1 << (UART0_IRQ % 32));
 
 	/* 
-	 * Set priority threshold for UART0.
+	 * Set priority threshold.
 	 *
 	 * PLIC will mask all interrupts of a priority less than or equal to threshold.
 	 * Maximum threshold is 7.
@@ -56,7 +69,7 @@ void plic_init(void)
  */
 int plic_claim(void)
 {
-	int hart = r_tp();
+	int hart = r_mhartid();
 	int irq = *(uint32_t*)PLIC_MCLAIM(hart);
 	return irq;
 }
@@ -73,6 +86,142 @@ int plic_claim(void)
  */
 void plic_complete(int irq)
 {
-	int hart = r_tp();
+	int hart = r_mhartid();
 	*(uint32_t*)PLIC_MCOMPLETE(hart) = irq;
 }
+
+/*
+ * DESCRIPTION:
+ *	Get the priority of an interrupt source.
+ * RETURN VALUE: priority of the irq, 0 means "never interrupt".
+ */
+int plic_get_priority(int irq)
+{
+	return *(uint32_t*)PLIC_PRIORITY(irq);
+}
+
+/*
+ * DESCRIPTION:
+ *	Get/Set the priority threshold of current hart. Interrupts of a
+ *	priority less than or equal to threshold are masked.
+ */
+int plic_get_threshold(void)
+{
+	int hart = r_mhartid();
+	return *(uint32_t*)PLIC_MTHRESHOLD(hart);
+}
+
+void plic_set_threshold(int threshold)
+{
+	int hart = r_mhartid();
+	*(uint32_t*)PLIC_MTHRESHOLD(hart) = threshold;
+}
+
+/*
+ * DESCRIPTION:
+ *	Register the handler of an interrupt source, set its priority and
+ *	enable it for current hart.
+ *	- irq: interrupt ID, 1 ~ PLIC_NUM_SOURCES
+ *	- handler: called with arg when the interrupt is raised
+ *	- priority: 1 (lowest) ~ 7 (highest)
+ * RETURN VALUE:
+ *	0: success
+ *	-1: if error occured
+ */
+int request_irq(int irq, void (*handler)(void *arg), void *arg, int priority)
+{
+	int hart = r_mhartid();
+
+	if (irq <= 0 || irq > PLIC_NUM_SOURCES || NULL == handler ||
+	    priority < 1 || priority > 7) {
+		return -1;
+	}
+	if (NULL != irq_table[irq].handler) {
+		return -1;
+	}
+
+	irq_table[irq].handler = handler;
+	irq_table[irq].arg = arg;
+
+	*(uint32_t*)PLIC_PRIORITY(irq) = priority;
+	/*
+	 * Each global interrupt can be enabled by setting the corresponding
+	 * bit in the enables registers.
+	 */
+	*(uint32_t*)PLIC_MENABLE(hart, irq) |= (1 << (irq % 32));
+
+	return 0;
+}
+
+/*
+ * DESCRIPTION:
+ *	Disable an interrupt source and unregister its handler.
+ */
+void free_irq(int irq)
+{
+	int hart = r_mhartid();
+
+	if (irq <= 0 || irq > PLIC_NUM_SOURCES) {
+		return;
+	}
+
+	*(uint32_t*)PLIC_MENABLE(hart, irq) &= ~(1 << (irq % 32));
+	*(uint32_t*)PLIC_PRIORITY(irq) = 0;
+
+	irq_table[irq].handler = NULL;
+	irq_table[irq].arg = NULL;
+}
+
+/*
+ * DESCRIPTION:
+ *	Call the handler registered for irq, and account the call.
+ * RETURN VALUE:
+ *	0: success
+ *	-1: no handler registered for irq
+ */
+int irq_dispatch(int irq)
+{
+	struct irq_desc *desc = &irq_table[irq];
+
+	if (NULL == desc->handler) {
+		return -1;
+	}
+
+	uint32_t start = *(uint32_t*)CLINT_MTIME;
+	desc->handler(desc->arg);
+	uint32_t ticks = *(uint32_t*)CLINT_MTIME - start;
+
+	int bucket = 0;
+	while (ticks >>= 1) {
+		bucket++;
+	}
+	if (bucket >= IRQ_HIST_BUCKETS) {
+		bucket = IRQ_HIST_BUCKETS - 1;
+	}
+
+	desc->count++;
+	desc->hist[bucket]++;
+
+	return 0;
+}
+
+/*
+ * DESCRIPTION:
+ *	Print the counter and the histogram of handler durations of each
+ *	interrupt source which has ever been raised.
+ */
+void irq_report(void)
+{
+	for (int irq = 1; irq <= PLIC_NUM_SOURCES; irq++) {
+		struct irq_desc *desc = &irq_table[irq];
+		if (0 == desc->count) {
+			continue;
+		}
+		printf("irq %d: count = %d\n", irq, desc->count);
+		for (int i = 0; i < IRQ_HIST_BUCKETS; i++) {
+			if (desc->hist[i]) {
+				printf("    < %d ticks: %d\n", 2 << i, desc->hist[i]);
+			}
+		}
+	}
+}
@@ -4,118 +4,272 @@
  * ref: https://github.com/cccriscv/mini-riscv-os/blob/master/05-Preemptive/lib.c
  */
 
-static int _vsnprintf(char * out, size_t n, const char* s, va_list vl)
+/*
+ * Formatted output is emitted in one pass to a sink, which is a callback
+ * taking one character at a time, so we don't need to format the whole
+ * string into a buffer first, or to format it twice to learn its size.
+ */
+typedef void (*sink_t)(char ch, void *arg);
+
+/*
+ * Divide a 64-bit number by a divisor less than 2^16 with 32-bit operations
+ * only, because we have no libgcc to do 64-bit division for us.
+ * The remainder is always less than d, so every partial dividend below fits
+ * in 32 bits.
+ */
+uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t *rem)
+{
+	uint32_t hi = (uint32_t)(n >> 32);
+	uint32_t lo = (uint32_t)n;
+
+	uint32_t q_hi = hi / d;
+	uint32_t r = hi % d;
+
+	uint32_t t = (r << 16) | (lo >> 16);
+	uint32_t q1 = t / d;
+	r = t % d;
+
+	t = (r << 16) | (lo & 0xffff);
+	uint32_t q0 = t / d;
+	r = t % d;
+
+	*rem = r;
+	return ((uint64_t)q_hi << 32) | (q1 << 16) | q0;
+}
+
+/*
+ * convert num to digits in reverse order, return number of digits.
+ */
+static int _utoa(uint64_t num, int base, char *digits)
+{
+	static const char hex[] = "0123456789abcdef";
+	int len = 0;
+
+	if ((num >> 32) == 0) {
+		/* fast path for the most common 32-bit numbers */
+		uint32_t n = (uint32_t)num;
+		do {
+			digits[len++] = hex[n % base];
+			n /= base;
+		} while (n);
+	} else {
+		uint32_t rem;
+		do {
+			num = div_u64_rem(num, base, &rem);
+			digits[len++] = hex[rem];
+		} while (num);
+	}
+	return len;
+}
+
+static inline void _pad(sink_t out, void *arg, char ch, int n)
+{
+	while (n-- > 0) {
+		out(ch, arg);
+	}
+}
+
+/*
+ * Supported conversion: %[flags][width][length]type
+ * - flags: '0' pads with zeros, '-' aligns to the left
+ * - width: minimal number of characters to output
+ * - length: 'l' for long, 'll' for long long
+ * - type: d, u, x, p, s, c and %
+ * RETURN VALUE: number of characters emitted
+ */
+static int _vformat(sink_t out, void *arg, const char *s, va_list vl)
 {
-	int format = 0;
-	int longarg = 0;
-	size_t pos = 0;
+	int pos = 0;
+
 	for (; *s; s++) {
-		if (format) {
-			switch(*s) {
-			case 'l': {
-				longarg = 1;
+		if (*s != '%') {
+			out(*s, arg);
+			pos++;
+			continue;
+		}
+
+		s++;
+		int zero = 0;
+		int left = 0;
+		for (;; s++) {
+			if (*s == '0') {
+				zero = 1;
+			} else if (*s == '-') {
+				left = 1;
+			} else {
 				break;
 			}
-			case 'p': {
-				longarg = 1;
-				if (out && pos < n) {
-					out[pos] = '0';
-				}
-				pos++;
-				if (out && pos < n) {
-					out[pos] = 'x';
-				}
-				pos++;
-			}
-			case 'x': {
-				long num = longarg ? va_arg(vl, long) : va_arg(vl, int);
-				int hexdigits = 2*(longarg ? sizeof(long) : sizeof(int))-1;
-				for(int i = hexdigits; i >= 0; i--) {
-					int d = (num >> (4*i)) & 0xF;
-					if (out && pos < n) {
-						out[pos] = (d < 10 ? '0'+d : 'a'+d-10);
-					}
-					pos++;
-				}
-				longarg = 0;
-				format = 0;
-				break;
+		}
+		int width = 0;
+		for (; *s >= '0' && *s <= '9'; s++) {
+			width = width * 10 + (*s - '0');
+		}
+		int longarg = 0;
+		for (; *s == 'l'; s++) {
+			longarg++;
+		}
+
+		char digits[24];
+		const char *str = digits;
+		int len = 0;
+		int neg = 0;
+		int reversed = 0;
+		uint64_t num;
+
+		switch (*s) {
+		case 'd':
+			if (longarg >= 2) {
+				long long n = va_arg(vl, long long);
+				neg = n < 0;
+				num = neg ? -(uint64_t)n : (uint64_t)n;
+			} else {
+				long n = longarg ? va_arg(vl, long) : va_arg(vl, int);
+				neg = n < 0;
+				num = neg ? -(uint32_t)n : (uint32_t)n;
 			}
-			case 'd': {
-				long num = longarg ? va_arg(vl, long) : va_arg(vl, int);
-				if (num < 0) {
-					num = -num;
-					if (out && pos < n) {
-						out[pos] = '-';
-					}
-					pos++;
-				}
-				long digits = 1;
-				for (long nn = num; nn /= 10; digits++);
-				for (int i = digits-1; i >= 0; i--) {
-					if (out && pos + i < n) {
-						out[pos + i] = '0' + (num % 10);
-					}
-					num /= 10;
-				}
-				pos += digits;
-				longarg = 0;
-				format = 0;
-				break;
+			len = _utoa(num, 10, digits);
+			reversed = 1;
+			break;
+		case 'u':
+		case 'x':
+			if (longarg >= 2) {
+				num = va_arg(vl, unsigned long long);
+			} else {
+				num = longarg ? va_arg(vl, unsigned long) : va_arg(vl, unsigned int);
 			}
-			case 's': {
-				const char* s2 = va_arg(vl, const char*);
-				while (*s2) {
-					if (out && pos < n) {
-						out[pos] = *s2;
-					}
-					pos++;
-					s2++;
-				}
-				longarg = 0;
-				format = 0;
-				break;
+			len = _utoa(num, *s == 'u' ? 10 : 16, digits);
+			reversed = 1;
+			break;
+		case 'p':
+			/* pointers are always printed with all the hex digits */
+			out('0', arg);
+			out('x', arg);
+			pos += 2;
+			num = (reg_t)va_arg(vl, void *);
+			len = _utoa(num, 16, digits);
+			reversed = 1;
+			zero = 1;
+			width = 2 * sizeof(void *);
+			break;
+		case 's':
+			str = va_arg(vl, const char *);
+			while (str[len]) {
+				len++;
 			}
-			case 'c': {
-				if (out && pos < n) {
-					out[pos] = (char)va_arg(vl,int);
-				}
-				pos++;
-				longarg = 0;
-				format = 0;
-				break;
+			break;
+		case 'c':
+			digits[0] = (char)va_arg(vl, int);
+			len = 1;
+			break;
+		case '%':
+			digits[0] = '%';
+			len = 1;
+			break;
+		default:
+			/* unknown conversion, just ignore it */
+			if (!*s) {
+				s--;
 			}
-			default:
-				break;
+			continue;
+		}
+
+		int padding = width - len - neg;
+		if (!left && !zero) {
+			_pad(out, arg, ' ', padding);
+		}
+		if (neg) {
+			out('-', arg);
+		}
+		if (!left && zero) {
+			_pad(out, arg, '0', padding);
+		}
+		if (reversed) {
+			/* digits of numbers are in reverse order */
+			for (int i = len - 1; i >= 0; i--) {
+				out(digits[i], arg);
 			}
-		} else if (*s == '%') {
-			format = 1;
 		} else {
-			if (out && pos < n) {
-				out[pos] = *s;
+			for (int i = 0; i < len; i++) {
+				out(str[i], arg);
 			}
-			pos++;
 		}
-    	}
-	if (out && pos < n) {
-		out[pos] = 0;
-	} else if (out && n) {
-		out[n-1] = 0;
+		if (left) {
+			_pad(out, arg, ' ', padding);
+		}
+		pos += neg + len + (padding > 0 ? padding : 0);
 	}
+
 	return pos;
 }
 
-static char out_buf[1000]; // buffer for _vprintf()
+/*
+ * buffer sink, used by vsnprintf(), output beyond the buffer is discarded.
+ */
+struct buf_sink {
+	char *buf;
+	size_t n;
+	size_t pos;
+};
+
+static void _buf_out(char ch, void *arg)
+{
+	struct buf_sink *bs = arg;
+	if (bs->pos + 1 < bs->n) {
+		bs->buf[bs->pos] = ch;
+	}
+	bs->pos++;
+}
+
+int vsnprintf(char *out, size_t n, const char *s, va_list vl)
+{
+	struct buf_sink bs = { out, n, 0 };
+	int res = _vformat(_buf_out, &bs, s, vl);
+	if (n) {
+		out[bs.pos < n ? bs.pos : n - 1] = 0;
+	}
+	return res;
+}
+
+int snprintf(char *out, size_t n, const char *s, ...)
+{
+	int res = 0;
+	va_list vl;
+	va_start(vl, s);
+	res = vsnprintf(out, n, s, vl);
+	va_end(vl);
+	return res;
+}
+
+/*
+ * uart sink, used by printf(). Characters are collected in a small chunk
+ * on the stack of the caller and passed to the UART a chunk at a time, so
+ * printf() needs no global buffer, and it is reentrant.
+ */
+#define UART_CHUNK_SIZE 32
+
+struct uart_sink {
+	char chunk[UART_CHUNK_SIZE];
+	int len;
+};
+
+static void _uart_out(char ch, void *arg)
+{
+	struct uart_sink *us = arg;
+	us->chunk[us->len++] = ch;
+	if (us->len == UART_CHUNK_SIZE) {
+		uart_write(us->chunk, us->len);
+		us->len = 0;
+	}
+}
 
 static int _vprintf(const char* s, va_list vl)
 {
-	int res = _vsnprintf(NULL, -1, s, vl);
-	if (res+1 >= sizeof(out_buf)) {
-		uart_puts("error: output string size overflow\n");
-		while(1) {}
+	struct uart_sink us;
+	us.len = 0;
+	int res = _vformat(_uart_out, &us, s, vl);
+	if (us.len) {
+		uart_write(us.chunk, us.len);
 	}
-	_vsnprintf(out_buf, res + 1, s, vl);
-	uart_puts(out_buf);
 	return res;
 }
 
@@ -134,5 +288,57 @@ void panic(char *s)
 	printf("panic: ");
 	printf(s);
 	printf("\n");
+	/* interrupts may never come again, so push all output out now */
+	uart_flush();
 	while(1){};
 }
+
+static void _null_out(char ch, void *arg)
+{
+}
+
+static int _bench_format(int passes, struct buf_sink *bs, const char *s, ...)
+{
+	int res = 0;
+	va_list vl;
+	for (int i = 0; i < passes; i++) {
+		va_start(vl, s);
+		if (i + 1 < passes) {
+			res = _vformat(_null_out, NULL, s, vl);
+		} else {
+			res = _vformat(_buf_out, bs, s, vl);
+		}
+		va_end(vl);
+	}
+	return res;
+}
+
+#define BENCH_LOOPS 1000
+
+/*
+ * Microbenchmark, print the cycles per call to format a typical message:
+ * - "2 passes": measure the size first then format again, which was how
+ *   printf() worked before.
+ * - "1 pass": what printf() does now.
+ * The output goes to a buffer, so the UART is not counted in.
+ * It reads mcycle, so must be called in Machine mode.
+ */
+void printf_bench()
+{
+	char buf[64];
+	struct buf_sink bs;
+
+	for (int passes = 2; passes >= 1; passes--) {
+		reg_t start = r_mcycle();
+		for (int i = 0; i < BENCH_LOOPS; i++) {
+			bs.buf = buf;
+			bs.n = sizeof(buf);
+			bs.pos = 0;
+			_bench_format(passes, &bs, "tick: %d, addr = %p, %s\n",
+				      i, buf, "hello");
+		}
+		reg_t cycles = r_mcycle() - start;
+		printf("printf_bench: %d pass(es): %u cycles per call\n",
+		       passes, cycles / BENCH_LOOPS);
+	}
+}
@@ -0,0 +1,211 @@
+#include "os.h"
+#include "ring.h"
+
+/*
+ * Batched syscalls, see ring.h.
+ *
+ * The ring lies in user memory, it is checked as a whole and translated
+ * with user_ptr() by ring_enter(), then accessed at the kernel address with
+ * __copy_user(), which still recovers from faults, so a bad ring just fails
+ * the syscall. copy_to_user() can not be used for this, because timeouts
+ * are completed in the timer interrupt, where current task is not the
+ * owner of the ring. So a timeout keeps the address of the ring seen by its
+ * owner, and it is translated again when it expires: the page may have
+ * been copied on write since, after a fork().
+ */
+
+/* defined in usercopy.S */
+extern size_t __copy_user(void *dst, const void *src, size_t n);
+
+/* defined in syscall.c */
+extern int sys_write_nowait(int fd, const char *buf, int n);
+extern int sys_sleep(unsigned int ms);
+
+/*
+ * Pending RING_OP_TIMEOUT operations, checked on every timer interrupt by
+ * ring_timeout_check(), and cancelled when the owner exits, see
+ * ring_task_exit(). A slot is free if ring is NULL.
+ * Notice the timers of timer.c can not be used here, because spin_lock()
+ * would enable interrupts inside the syscall.
+ */
+#define MAX_RING_TIMEOUTS 8
+
+struct ring_timeout {
+	int task;		/* the owner of the ring */
+	struct sys_ring *ring;	/* the address of the ring seen by the owner */
+	uint32_t user_data;
+	uint64_t expire;
+};
+
+static struct ring_timeout timeouts[MAX_RING_TIMEOUTS];
+
+/*
+ * DESCRIPTION
+ * 	Post a completion to the cq of ring.
+ * RETURN VALUE
+ * 	0: success, or the cq is full and the completion is dropped
+ * 	-1: the ring is bad
+ */
+static int ring_complete(struct sys_ring *ring, uint32_t user_data, int res)
+{
+	/* cq_head and cq_tail are adjacent, fetch them at a time */
+	uint32_t cq[2];
+	if (__copy_user(cq, &ring->cq_head, sizeof(cq))) {
+		return -1;
+	}
+
+	if (cq[1] - cq[0] >= RING_ENTRIES) {
+		uint32_t overflow;
+		if (__copy_user(&overflow, &ring->cq_overflow, sizeof(overflow))) {
+			return -1;
+		}
+		overflow++;
+		return __copy_user(&ring->cq_overflow, &overflow, sizeof(overflow)) ? -1 : 0;
+	}
+
+	struct ring_cqe cqe = { user_data, res };
+	if (__copy_user(&ring->cq[cq[1] % RING_ENTRIES], &cqe, sizeof(cqe))) {
+		return -1;
+	}
+
+	/* the task must not see the new tail before the entry itself */
+	__sync_synchronize();
+	cq[1]++;
+	return __copy_user(&ring->cq_tail, &cq[1], sizeof(cq[1])) ? -1 : 0;
+}
+
+static int ring_timeout_add(struct sys_ring *ring, uint32_t user_data, uint32_t ms)
+{
+	for (int i = 0; i < MAX_RING_TIMEOUTS; i++) {
+		struct ring_timeout *t = &timeouts[i];
+		if (NULL == t->ring) {
+			t->task = task_getpid();
+			t->ring = ring;
+			t->user_data = user_data;
+			t->expire = get_mtime() + (uint64_t)ms * (CLINT_TIMEBASE_FREQ / 1000);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* the kernel address of the ring of timeout t, or NULL if it is bad */
+static struct sys_ring *ring_timeout_ring(struct ring_timeout *t)
+{
+	pagetable_t pt = task_pagetable_of(t->task);
+	if (NULL == pt) {
+		return t->ring;
+	}
+	return uvm_ptr(pt, (reg_t)t->ring, sizeof(struct sys_ring), 1);
+}
+
+/*
+ * DESCRIPTION
+ * 	Complete the expired RING_OP_TIMEOUT operations, called by the timer
+ * 	interrupt handler, so the resolution is the timer interval.
+ */
+void ring_timeout_check(void)
+{
+	uint64_t now = get_mtime();
+
+	for (int i = 0; i < MAX_RING_TIMEOUTS; i++) {
+		struct ring_timeout *t = &timeouts[i];
+		if (NULL != t->ring && now >= t->expire) {
+			struct sys_ring *ring = ring_timeout_ring(t);
+			if (ring) {
+				ring_complete(ring, t->user_data, 0);
+			}
+			t->ring = NULL;
+		}
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Cancel the pending timeouts of task id, which is exiting, before its
+ * 	memory is freed.
+ */
+void ring_task_exit(int id)
+{
+	for (int i = 0; i < MAX_RING_TIMEOUTS; i++) {
+		if (timeouts[i].task == id) {
+			timeouts[i].ring = NULL;
+		}
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Consume all the operations in the sq of ring, the batch ends early
+ * 	at RING_OP_SLEEP, which puts current task to sleep after the syscall.
+ * 	The result of each operation is posted to the cq, except that of
+ * 	RING_OP_TIMEOUT, which is posted when it expires.
+ * RETURN VALUE
+ * 	number of operations consumed, or -1 if the ring is bad.
+ */
+int sys_ring_enter(struct sys_ring *uring)
+{
+	struct sys_ring *ring = user_ptr(VERIFY_WRITE, uring, sizeof(*ring));
+	if (NULL == ring) {
+		return -1;
+	}
+
+	/* sq_head and sq_tail are adjacent, fetch them at a time */
+	uint32_t sq[2];
+	if (__copy_user(sq, &ring->sq_head, sizeof(sq))) {
+		return -1;
+	}
+	if (sq[1] - sq[0] > RING_ENTRIES) {
+		return -1;
+	}
+
+	uint32_t head = sq[0];
+	uint32_t sleep_ms = 0;
+	int sleep = 0;
+	int n = 0;
+
+	while (head != sq[1] && !sleep) {
+		struct ring_sqe sqe;
+		if (__copy_user(&sqe, &ring->sq[head % RING_ENTRIES], sizeof(sqe))) {
+			return -1;
+		}
+		head++;
+		n++;
+
+		int res;
+		switch (sqe.opcode) {
+		case RING_OP_NOP:
+			res = 0;
+			break;
+		case RING_OP_WRITE:
+			res = sys_write_nowait(sqe.fd, (const char *)sqe.addr, sqe.len);
+			break;
+		case RING_OP_SLEEP:
+			sleep = 1;
+			sleep_ms = sqe.len;
+			res = 0;
+			break;
+		case RING_OP_TIMEOUT:
+			if (0 == ring_timeout_add(uring, sqe.user_data, sqe.len)) {
+				/* completed later */
+				continue;
+			}
+			res = -1;
+			break;
+		default:
+			res = -1;
+		}
+
+		if (ring_complete(ring, sqe.user_data, res)) {
+			return -1;
+		}
+	}
+
+	if (__copy_user(&ring->sq_head, &head, sizeof(head))) {
+		return -1;
+	}
+	if (sleep) {
+		sys_sleep(sleep_ms);
+	}
+	return n;
+}
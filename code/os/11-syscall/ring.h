@@ -0,0 +1,53 @@
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "types.h"
+
+/*
+ * Batched syscalls, shared by the kernel and user tasks.
+ *
+ * A task puts operations into the submission queue (sq) of a ring in its
+ * own memory, then flushes them all with a single ring_enter() syscall.
+ * The kernel consumes them in order, and posts the result of each one to
+ * the completion queue (cq), tagged with the user_data of the operation.
+ *
+ * Both queues are single producer/single consumer:
+ * - sq: the task produces at sq_tail, the kernel consumes at sq_head
+ * - cq: the kernel produces at cq_tail, the task consumes at cq_head
+ * The indexes only increase and wrap around at 2^32, the slot of index i is
+ * i % RING_ENTRIES.
+ * If the cq is full, the completion is dropped and counted in cq_overflow.
+ * With CONFIG_PAGING, the ring must not cross a page boundary.
+ */
+#define RING_ENTRIES 16		/* must be a power of 2 */
+
+/* operations */
+#define RING_OP_NOP	0	/* completes with 0 */
+#define RING_OP_WRITE	1	/* write(fd, addr, len) */
+#define RING_OP_SLEEP	2	/* sleep(len ms), ends the batch */
+#define RING_OP_TIMEOUT	3	/* completes with 0 after len ms */
+
+struct ring_sqe {
+	uint32_t opcode;
+	int fd;
+	uint32_t addr;
+	uint32_t len;
+	uint32_t user_data;
+};
+
+struct ring_cqe {
+	uint32_t user_data;
+	int res;		/* result of the operation, -1 on error */
+};
+
+struct sys_ring {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	uint32_t cq_overflow;
+	struct ring_sqe sq[RING_ENTRIES];
+	struct ring_cqe cq[RING_ENTRIES];
+};
+
+#endif /* __RING_H__ */
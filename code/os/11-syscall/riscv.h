@@ -14,6 +14,13 @@ static inline reg_t r_tp()
 	return x;
 }
 
+static inline reg_t r_sp()
+{
+	reg_t x;
+	asm volatile("mv %0, sp" : "=r" (x) );
+	return x;
+}
+
 /* which hart (core) is this? */
 static inline reg_t r_mhartid()
 {
@@ -69,7 +76,15 @@ static inline void w_mscratch(reg_t x)
 	asm volatile("csrw mscratch, %0" : : "r" (x));
 }
 
-/* Machine-mode interrupt vector */
+/*
+ * Machine-mode interrupt vector
+ * The low two bits of mtvec is the MODE field:
+ * - Direct: all traps set pc to BASE.
+ * - Vectored: asynchronous interrupts set pc to BASE+4*cause.
+ */
+#define MTVEC_MODE_DIRECT	0
+#define MTVEC_MODE_VECTORED	1
+
 static inline void w_mtvec(reg_t x)
 {
 	asm volatile("csrw mtvec, %0" : : "r" (x));
@@ -99,4 +114,111 @@ static inline reg_t r_mcause()
 	return x;
 }
 
+/* the faulting address of a page fault */
+static inline reg_t r_mtval()
+{
+	reg_t x;
+	asm volatile("csrr %0, mtval" : "=r" (x) );
+	return x;
+}
+
+/* Machine-mode cycle counter, lower 32 bits */
+static inline reg_t r_mcycle()
+{
+	reg_t x;
+	asm volatile("csrr %0, mcycle" : "=r" (x) );
+	return x;
+}
+
+/*
+ * Physical Memory Protection, only entries 0 ~ 3 are used, which are all
+ * configured by pmpcfg0 on RV32, 8 bits for each entry.
+ */
+#define PMP_R		(1 << 0)
+#define PMP_W		(1 << 1)
+#define PMP_X		(1 << 2)
+#define PMP_A_OFF	(0 << 3)
+#define PMP_A_TOR	(1 << 3)
+#define PMP_A_NA4	(2 << 3)
+#define PMP_A_NAPOT	(3 << 3)
+#define PMP_L		(1 << 7)
+
+/* config of entry i in pmpcfg0 */
+#define PMP_CFG(i, cfg)	((reg_t)(cfg) << ((i) * 8))
+
+static inline void w_pmpcfg0(reg_t x)
+{
+	asm volatile("csrw pmpcfg0, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr0(reg_t x)
+{
+	asm volatile("csrw pmpaddr0, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr1(reg_t x)
+{
+	asm volatile("csrw pmpaddr1, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr2(reg_t x)
+{
+	asm volatile("csrw pmpaddr2, %0" : : "r" (x));
+}
+
+static inline void w_pmpaddr3(reg_t x)
+{
+	asm volatile("csrw pmpaddr3, %0" : : "r" (x));
+}
+
+/*
+ * Supervisor address translation and protection, satp, which is used by
+ * User mode as well. Machine mode is never translated.
+ */
+#define SATP_SV32 (1 << 31)
+#define SATP_ASID_SHIFT 22
+
+/* use Sv32 page table pt, with the address space ID asid */
+#define MAKE_SATP(asid, pt) \
+	(SATP_SV32 | ((reg_t)(asid) << SATP_ASID_SHIFT) | (((reg_t)(pt)) >> 12))
+
+static inline void w_satp(reg_t x)
+{
+	asm volatile("csrw satp, %0" : : "r" (x));
+}
+
+/* flush the TLB entries of the virtual address va in all address spaces */
+static inline void sfence_vma(reg_t va)
+{
+	asm volatile("sfence.vma %0, zero" : : "r" (va) : "memory");
+}
+
+/* flush the TLB entries of the address space asid */
+static inline void sfence_vma_asid(reg_t asid)
+{
+	asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
+/* Sv32 page table entry */
+#define PTE_V (1 << 0)	/* valid */
+#define PTE_R (1 << 1)
+#define PTE_W (1 << 2)
+#define PTE_X (1 << 3)
+#define PTE_U (1 << 4)	/* user can access */
+#define PTE_G (1 << 5)	/* global mapping */
+#define PTE_A (1 << 6)	/* accessed */
+#define PTE_D (1 << 7)	/* dirty */
+
+typedef reg_t pte_t;
+typedef pte_t *pagetable_t;	/* 1024 PTEs */
+
+/* shift a physical address to the right place for a PTE, and back */
+#define PA2PTE(pa) ((((reg_t)(pa)) >> 12) << 10)
+#define PTE2PA(pte) (((pte) >> 10) << 12)
+#define PTE_FLAGS(pte) ((pte) & 0x3ff)
+
+/* extract the two 10-bit page table indices from a virtual address */
+#define PX_SHIFT(level) (12 + (10 * (level)))
+#define PX(level, va) ((((reg_t)(va)) >> PX_SHIFT(level)) & 0x3ff)
+
 #endif /* __RISCV_H__ */
@@ -1,15 +1,53 @@
 #include "os.h"
 
+#if defined(CONFIG_PMP) && defined(CONFIG_PAGING)
+#error "CONFIG_PMP and CONFIG_PAGING can not be used together"
+#endif
+
+/*
+ * The memory settings of a task, loaded by switch_to() when switching to
+ * it, see mm_setup().
+ */
+struct mm {
+	reg_t satp;	/* 0 if not translated */
+	reg_t pmpcfg0;
+	reg_t pmpaddr0;
+	reg_t pmpaddr1;
+	pagetable_t pagetable;
+};
+
 /* defined in entry.S */
-extern void switch_to(struct context *next);
+extern void switch_to(struct context *next, struct mm *mm);
+
+/* defined in start.S, reused as the interrupt stacks of harts */
+extern uint8_t stacks[];
 
 #define MAX_TASKS 10
+#ifdef CONFIG_PAGING
+/* a stack is mapped into the address space of its task as a whole page */
+#define STACK_SIZE PAGE_SIZE
+#else
 #define STACK_SIZE 1024
+#endif
 /*
  * In the standard RISC-V calling convention, the stack pointer sp
- * is always 16-byte aligned.
+ * is always 16-byte aligned. Besides, each stack is aligned on its size,
+ * so it can be covered by a single NAPOT region of PMP, or a page.
+ */
+uint8_t __attribute__((aligned(STACK_SIZE))) task_stack[MAX_TASKS][STACK_SIZE];
+
+/*
+ * Each task has a heap, its address is passed in a0. With CONFIG_PAGING,
+ * the heap is made of pages which are allocated on demand, and not
+ * contiguous physically, at USER_HEAP_BASE, otherwise it is a single page.
  */
-uint8_t __attribute__((aligned(16))) task_stack[MAX_TASKS][STACK_SIZE];
+#ifdef CONFIG_PAGING
+#define TASK_HEAP_PAGES 16
+#define USER_HEAP_BASE 0x40000000
+#else
+#define TASK_HEAP_PAGES 1
+#endif
+#define TASK_HEAP_SIZE (TASK_HEAP_PAGES * PAGE_SIZE)
 struct context ctx_tasks[MAX_TASKS];
 
 /*
@@ -19,16 +57,250 @@ struct context ctx_tasks[MAX_TASKS];
 static int _top = 0;
 static int _current = -1;
 
+/* task states */
+#define TASK_READY	0
+#define TASK_BLOCKED	1
+#define TASK_SLEEPING	2
+#define TASK_EXITED	3
+
+struct task {
+	int state;
+	void *chan;	/* what the task is waiting for when it is blocked */
+	uint64_t wake;	/* mtime to wake up at when it is sleeping */
+	int kernel;	/* if it can access the whole memory */
+	uint8_t *heap;	/* address of the heap seen by the task */
+	reg_t stack;	/* address of the stack seen by the task */
+	struct task *parent;	/* the task it is forked from, or NULL */
+	struct mm mm;
+};
+static struct task tasks[MAX_TASKS];
+
+/*
+ * The idle task runs when all the tasks are blocked. It is not counted in
+ * _top, and _current is -1 while it is running.
+ */
+#define IDLE_STACK_SIZE 128
+static uint8_t __attribute__((aligned(IDLE_STACK_SIZE))) idle_stack[IDLE_STACK_SIZE];
+static struct context ctx_idle;
+static struct mm mm_idle;
+
+static void idle_task(void)
+{
+	/*
+	 * Zero pages in advance for page_alloc_zeroed(), then just spin here,
+	 * notice we can not use wfi here because it is an illegal instruction
+	 * for User mode on QEMU-virt.
+	 */
+	while (1) {
+		page_zero_idle();
+	}
+}
+
+/*
+ * The lowest word of each stack holds a canary. Stacks grow downwards, so
+ * once a stack overflows, the canary would be overwritten first, and this
+ * is checked on every context switch, before the overflow silently corrupts
+ * the neighbouring stack for too long.
+ */
+#define STACK_CANARY 0x57ac6e9d
+
+static inline uint32_t *_canary(uint8_t *stack)
+{
+	return (uint32_t *)stack;
+}
+
+static void stack_check(int id)
+{
+	if (*_canary(task_stack[id]) != STACK_CANARY) {
+		printf("task %d: ", id);
+		panic("stack overflow!");
+	}
+
+	int hart = r_mhartid();
+	if (*_canary(&stacks[hart * HART_STACK_SIZE]) != STACK_CANARY) {
+		printf("hart %d: ", hart);
+		panic("irq stack overflow!");
+	}
+}
+
+/* defined in os.ld */
+extern uint8_t _text_start[];
+extern uint8_t _rodata_end[];
+
+#ifdef CONFIG_PMP
+/* if [addr, addr + n) lies in [base, base + size) */
+static inline int _in_region(reg_t addr, size_t n, reg_t base, reg_t size)
+{
+	/* offset wraps around if addr < base */
+	reg_t offset = addr - base;
+	return offset < size && n <= size - offset;
+}
+
+/*
+ * NAPOT encoding of a region of size bytes, where size is a power of 2
+ * (at least 8), and base is aligned on size.
+ */
+static inline reg_t pmp_napot(void *base, reg_t size)
+{
+	return ((reg_t)base >> 2) | ((size >> 3) - 1);
+}
+#endif
+
+/*
+ * Set up the PMP settings of a task, which only apply in User mode:
+ * - entry 0: the stack of the task, R/W (NAPOT)
+ * - entry 1: the heap of the task, R/W (NAPOT), or the whole memory, R/W/X
+ *   for a kernel task
+ * - entry 2 & 3: the code and the read-only data of the kernel, which are
+ *   shared by all the tasks, R/X (TOR). pmpaddr2 and pmpaddr3 are set once
+ *   in sched_init().
+ * Anything else is not accessible in User mode. The entries are encoded
+ * here once, so that switch_to() just writes three CSRs.
+ */
+static void pmp_setup(struct mm *mm, uint8_t *stack, int stack_size,
+		      uint8_t *heap, int kernel)
+{
+#ifdef CONFIG_PMP
+	mm->pmpaddr0 = pmp_napot(stack, stack_size);
+	mm->pmpcfg0 = PMP_CFG(0, PMP_A_NAPOT | PMP_R | PMP_W) |
+		      PMP_CFG(3, PMP_A_TOR | PMP_R | PMP_X);
+	if (kernel) {
+		/* all ones means the whole address space */
+		mm->pmpaddr1 = -1;
+		mm->pmpcfg0 |= PMP_CFG(1, PMP_A_NAPOT | PMP_R | PMP_W | PMP_X);
+	} else {
+		mm->pmpaddr1 = pmp_napot(heap, TASK_HEAP_SIZE);
+		mm->pmpcfg0 |= PMP_CFG(1, PMP_A_NAPOT | PMP_R | PMP_W);
+	}
+#endif
+}
+
+#ifdef CONFIG_PAGING
+/*
+ * Build the page table of a user task, with ASID id + 1, since ASID 0 is
+ * left for the tasks which are not translated:
+ * - the code and the read-only data of the kernel, R/X, mapped at the same
+ *   addresses, since the tasks run the code linked with the kernel
+ * - the stack of the task, R/W, mapped at the same address as well, so
+ *   the kernel can access it without translation (e.g. for stack_check())
+ * - the heap of the task, R/W, at USER_HEAP_BASE, which is only reserved
+ *   here, the pages are allocated on the first touch, see uvm_fault()
+ * Anything else is not accessible in User mode.
+ * The TLB entries are tagged with the ASID, so switch_to() just writes
+ * satp without flushing the TLB, the ASID is flushed by mm_free() instead.
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: out of memory, whatever is built so far is freed
+ */
+static int uvm_setup(struct mm *mm, int id)
+{
+	pagetable_t pt = uvm_create();
+	if (NULL == pt) {
+		return -1;
+	}
+
+	reg_t text = (reg_t)_text_start & ~(PAGE_SIZE - 1);
+	reg_t text_end = ((reg_t)_rodata_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	if (uvm_map(pt, text, text, text_end - text, PTE_R | PTE_X | PTE_U) ||
+	    uvm_map(pt, tasks[id].stack, (reg_t)task_stack[id],
+		    STACK_SIZE, PTE_R | PTE_W | PTE_U)) {
+		goto fail;
+	}
+	if (NULL == tasks[id].parent) {
+		if (uvm_reserve(pt, USER_HEAP_BASE, TASK_HEAP_SIZE,
+				PTE_R | PTE_W | PTE_U)) {
+			goto fail;
+		}
+	} else {
+		if (uvm_share(tasks[id].parent->mm.pagetable, pt,
+			      USER_HEAP_BASE, TASK_HEAP_SIZE)) {
+			goto fail;
+		}
+	}
+
+	mm->pagetable = pt;
+	mm->satp = MAKE_SATP(id + 1, pt);
+	return 0;
+
+fail:
+	uvm_free(pt);
+	return -1;
+}
+#endif
+
+/*
+ * DESCRIPTION
+ * 	Set up the memory of task id: its heap, and its access to memory in
+ * 	User mode, by page table with CONFIG_PAGING, or by PMP with
+ * 	CONFIG_PMP. A kernel task is never restricted.
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: out of memory
+ */
+static int mm_setup(int id, int kernel)
+{
+	struct task *t = &tasks[id];
+
+#ifdef CONFIG_PAGING
+	if (!kernel) {
+		t->heap = (uint8_t *)USER_HEAP_BASE;
+		return uvm_setup(&t->mm, id);
+	}
+#endif
+	t->heap = page_alloc_zeroed(TASK_HEAP_PAGES);
+	if (NULL == t->heap) {
+		return -1;
+	}
+	pmp_setup(&t->mm, task_stack[id], STACK_SIZE, t->heap, kernel);
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Release the memory of task id set up by mm_setup() or task_fork(),
+ * 	when it exits.
+ */
+static void mm_free(int id)
+{
+	struct task *t = &tasks[id];
+
+#ifdef CONFIG_PAGING
+	if (t->mm.pagetable) {
+		uvm_free(t->mm.pagetable);
+		t->mm.pagetable = NULL;
+		/* the ASID is reused by the next task in this slot */
+		sfence_vma_asid(id + 1);
+		return;
+	}
+#endif
+	page_free(t->heap);
+	t->heap = NULL;
+}
+
 void sched_init()
 {
 	w_mscratch(0);
 
+	for (int i = 0; i < MAXNUM_CPU; i++) {
+		*_canary(&stacks[i * HART_STACK_SIZE]) = STACK_CANARY;
+	}
+
+	ctx_idle.sp = (reg_t) &idle_stack[IDLE_STACK_SIZE];
+	ctx_idle.pc = (reg_t) idle_task;
+	pmp_setup(&mm_idle, idle_stack, IDLE_STACK_SIZE, NULL, 1);
+
+#ifdef CONFIG_PMP
+	w_pmpaddr2((reg_t)_text_start >> 2);
+	w_pmpaddr3((reg_t)_rodata_end >> 2);
+#endif
+
 	/* enable machine-mode software interrupts. */
 	w_mie(r_mie() | MIE_MSIE);
 }
 
 /*
- * implment a simple cycle FIFO schedular
+ * implment a simple cycle FIFO schedular, blocked tasks are skipped, and
+ * the idle task runs if no task is ready.
  */
 void schedule()
 {
@@ -37,30 +309,391 @@ void schedule()
 		return;
 	}
 
-	_current = (_current + 1) % _top;
-	struct context *next = &(ctx_tasks[_current]);
-	switch_to(next);
+	trace_event(TRACE_SCHEDULE, _current, 0);
+
+	if (_current >= 0) {
+		stack_check(_current);
+	}
+
+	uint64_t now = get_mtime();
+	for (int i = 0; i < _top; i++) {
+		if (tasks[i].state == TASK_SLEEPING && now >= tasks[i].wake) {
+			tasks[i].state = TASK_READY;
+		}
+	}
+
+	for (int i = 1; i <= _top; i++) {
+		int id = (_current + i) % _top;
+		if (_current < 0) {
+			id = i - 1;
+		}
+		if (tasks[id].state == TASK_READY) {
+			_current = id;
+			trace_event(TRACE_SWITCH_TO, _current, 0);
+			switch_to(&(ctx_tasks[_current]), &(tasks[_current].mm));
+		}
+	}
+
+	_current = -1;
+	trace_event(TRACE_SWITCH_TO, _current, 0);
+	page_zero_refill();
+	switch_to(&ctx_idle, &mm_idle);
+}
+
+/*
+ * DESCRIPTION
+ * 	Block current task until task_wakeup() is called with the same chan,
+ * 	and switch to another task.
+ * 	This is called by syscalls in trap handler, with the whole context of
+ * 	current task saved. It never returns, the task will resume at the
+ * 	pc saved in its context, that is, the ecall instruction, so the
+ * 	syscall is simply issued again when the task is woken up.
+ */
+void task_sleep(void *chan)
+{
+	tasks[_current].state = TASK_BLOCKED;
+	tasks[_current].chan = chan;
+	schedule();
+}
+
+/*
+ * DESCRIPTION
+ * 	Make all the tasks blocked on chan ready again. This can be called
+ * 	in interrupt handlers.
+ */
+void task_wakeup(void *chan)
+{
+	for (int i = 0; i < _top; i++) {
+		if (tasks[i].state == TASK_BLOCKED && tasks[i].chan == chan) {
+			tasks[i].state = TASK_READY;
+			tasks[i].chan = NULL;
+		}
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Block current task until task_wakeup() is called with the same chan.
+ * 	Unlike task_sleep(), this is for kernel tasks out of trap handlers,
+ * 	which run in User mode and can't disable interrupts, it returns to
+ * 	the caller once the task is woken up, as task_sleep_until() does.
+ * 	The waker bumps *seq before task_wakeup(), and the caller passes the
+ * 	value it read before checking for work, so a wakeup between the
+ * 	check and here is not lost: the task is marked blocked first, then
+ * 	it just goes on if *seq has changed since.
+ */
+void task_block(void *chan, volatile uint32_t *seq, uint32_t seen)
+{
+	tasks[_current].chan = chan;
+	tasks[_current].state = TASK_BLOCKED;
+	__sync_synchronize();
+	if (*seq != seen) {
+		tasks[_current].state = TASK_READY;
+		tasks[_current].chan = NULL;
+		return;
+	}
+	task_yield();
+}
+
+/*
+ * DESCRIPTION
+ * 	Put current task to sleep until mtime reaches time. Unlike
+ * 	task_sleep(), this returns to the caller: it raises a software
+ * 	interrupt, which is taken as soon as the syscall returns to the task,
+ * 	so the task resumes after the ecall when it is woken up.
+ * 	Sleeping tasks are woken up by schedule(), so the resolution is the
+ * 	interval of the timer interrupt.
+ */
+void task_sleep_until(uint64_t time)
+{
+	tasks[_current].state = TASK_SLEEPING;
+	tasks[_current].wake = time;
+	task_yield();
+}
+
+/*
+ * DESCRIPTION
+ * 	Terminate current task, it will never be scheduled again, its memory
+ * 	is freed, and its slot is reused by the next task created.
+ * 	This never returns.
+ */
+void task_exit()
+{
+	tasks[_current].state = TASK_EXITED;
+	ring_task_exit(_current);
+	mm_free(_current);
+	schedule();
+}
+
+/*
+ * RETURN VALUE
+ * 	id of current task, -1 for the idle task.
+ */
+int task_getpid()
+{
+	return _current;
+}
+
+#ifdef CONFIG_STACK_PAINT
+/*
+ * fill the whole stack with STACK_PAINT_PATTERN before it is used.
+ */
+static void stack_paint(uint8_t *stack, int size)
+{
+	uint32_t *p = (uint32_t *)stack;
+	for (int i = 0; i < size / sizeof(uint32_t); i++) {
+		p[i] = STACK_PAINT_PATTERN;
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Get the high-water mark of a painted stack. The stack grows downwards,
+ * 	so we search upwards from the bottom (skipping the canary) for the
+ * 	first word which is not the paint pattern any more.
+ * RETURN VALUE
+ * 	max number of bytes which have ever been used on the stack.
+ */
+static int stack_usage(uint8_t *stack, int size)
+{
+	uint32_t *p = (uint32_t *)stack;
+	int i;
+	for (i = 1; i < size / sizeof(uint32_t); i++) {
+		if (p[i] != STACK_PAINT_PATTERN) {
+			break;
+		}
+	}
+	return size - i * sizeof(uint32_t);
+}
+
+/*
+ * DESCRIPTION
+ * 	Print the high-water mark of the stack of each task, and of the
+ * 	interrupt stack of each hart which has ever been used.
+ */
+void stack_report()
+{
+	for (int i = 0; i < _top; i++) {
+		printf("task %d stack: %d/%d bytes\n", i,
+		       stack_usage(task_stack[i], STACK_SIZE), STACK_SIZE);
+	}
+	for (int i = 0; i < MAXNUM_CPU; i++) {
+		uint8_t *stack = &stacks[i * HART_STACK_SIZE];
+		int used = stack_usage(stack, HART_STACK_SIZE);
+		if (used) {
+			printf("hart %d irq stack: %d/%d bytes\n", i,
+			       used, HART_STACK_SIZE);
+		}
+	}
+}
+#endif
+
+/*
+ * the slot of a new task: the first one of an exited task, or a new one
+ * at _top, which the caller has to count in _top once the task is set up.
+ * return -1 if there are already MAX_TASKS tasks.
+ */
+static int _task_slot(void)
+{
+	for (int i = 0; i < _top; i++) {
+		if (tasks[i].state == TASK_EXITED) {
+			return i;
+		}
+	}
+	return _top < MAX_TASKS ? _top : -1;
+}
+
+static int _task_create(void (*start_routin)(void), int kernel)
+{
+	int id = _task_slot();
+	if (id < 0) {
+		return -1;
+	}
+
+	tasks[id].stack = (reg_t) task_stack[id];
+	tasks[id].parent = NULL;
+	if (mm_setup(id, kernel)) {
+		return -1;
+	}
+
+#ifdef CONFIG_STACK_PAINT
+	stack_paint(task_stack[id], STACK_SIZE);
+#endif
+	*_canary(task_stack[id]) = STACK_CANARY;
+	ctx_tasks[id].sp = (reg_t) &task_stack[id][STACK_SIZE];
+	ctx_tasks[id].pc = (reg_t) start_routin;
+	ctx_tasks[id].a0 = (reg_t) tasks[id].heap;
+	tasks[id].state = TASK_READY;
+	tasks[id].kernel = kernel;
+	if (id == _top) {
+		_top++;
+	}
+	return 0;
 }
 
 /*
  * DESCRIPTION
  * 	Create a task.
- * 	- start_routin: task routine entry
+ * 	- start_routin: task routine entry, which gets the address of the
+ * 	  heap of the task in a0, i.e. its first argument.
+ * 	With CONFIG_PMP or CONFIG_PAGING, the task can only access its own
+ * 	stack and heap, and read/execute the kernel code, see mm_setup().
  * RETURN VALUE
  * 	0: success
  * 	-1: if error occured
  */
 int task_create(void (*start_routin)(void))
 {
-	if (_top < MAX_TASKS) {
-		ctx_tasks[_top].sp = (reg_t) &task_stack[_top][STACK_SIZE];
-		ctx_tasks[_top].pc = (reg_t) start_routin;
+	return _task_create(start_routin, 0);
+}
+
+/*
+ * DESCRIPTION
+ * 	Create a task running kernel code, which still runs in User mode
+ * 	but can access the whole memory.
+ */
+int task_create_kernel(void (*start_routin)(void))
+{
+	return _task_create(start_routin, 1);
+}
+
+/*
+ * DESCRIPTION
+ * 	Check if current task can access the memory [addr, addr + n), the
+ * 	same as PMP would check in User mode.
+ * 	- write: 1 for write access, 0 for read access
+ * RETURN VALUE
+ * 	1 if ok, 0 if not.
+ */
+int task_access_ok(reg_t addr, size_t n, int write)
+{
+#ifdef CONFIG_PMP
+	if (_current < 0 || tasks[_current].kernel) {
+		return 1;
+	}
+
+	return _in_region(addr, n, (reg_t)task_stack[_current], STACK_SIZE) ||
+	       _in_region(addr, n, (reg_t)tasks[_current].heap, TASK_HEAP_SIZE) ||
+	       (!write && _in_region(addr, n, (reg_t)_text_start,
+				     _rodata_end - _text_start));
+#else
+	/* with CONFIG_PAGING, the page table is checked by the copy */
+	return 1;
+#endif
+}
+
+/*
+ * DESCRIPTION
+ * 	Fork current task, called by the fork syscall with the whole context
+ * 	of current task saved. The child gets a copy of the stack at the same
+ * 	address, shares the heap copy-on-write, and resumes after the ecall
+ * 	just like its parent, but with 0 returned.
+ * 	Only the tasks with a page table can be forked, since the stack of
+ * 	the child has to be mapped at the address of the stack of its parent.
+ * RETURN VALUE
+ * 	id of the child, or -1 if error occured.
+ */
+int task_fork()
+{
+#ifdef CONFIG_PAGING
+	struct task *parent = &tasks[_current];
+	int id = _task_slot();
+
+	if (id < 0 || NULL == parent->mm.pagetable) {
+		return -1;
+	}
+
+	struct task *child = &tasks[id];
+	child->stack = parent->stack;
+	child->heap = parent->heap;
+	child->parent = parent;
+	child->kernel = 0;
+	if (uvm_setup(&child->mm, id)) {
+		return -1;
+	}
+
+	memcpy(task_stack[id], task_stack[_current], STACK_SIZE);
+	ctx_tasks[id] = ctx_tasks[_current];
+	ctx_tasks[id].pc += 4;
+	ctx_tasks[id].a0 = 0;
+	child->state = TASK_READY;
+	if (id == _top) {
 		_top++;
-		return 0;
-	} else {
+	}
+	return id;
+#else
+	return -1;
+#endif
+}
+
+/*
+ * DESCRIPTION
+ * 	Handle a page fault of current task in User mode, see uvm_fault().
+ * RETURN VALUE
+ * 	0: fixed, the access can be retried
+ * 	-1: a bad access
+ */
+int task_page_fault(reg_t va, int write)
+{
+	pagetable_t pt = task_pagetable();
+	if (NULL == pt) {
 		return -1;
 	}
+	return uvm_fault(pt, va, write);
+}
+
+/*
+ * RETURN VALUE
+ * 	the page table of current task, or NULL if it is not translated.
+ */
+pagetable_t task_pagetable()
+{
+	return task_pagetable_of(_current);
+}
+
+/*
+ * RETURN VALUE
+ * 	the page table of task id, or NULL if it is not translated.
+ */
+pagetable_t task_pagetable_of(int id)
+{
+	if (id < 0 || id >= _top) {
+		return NULL;
+	}
+	return tasks[id].mm.pagetable;
+}
+
+#ifdef CONFIG_PMP
+#define BENCH_LOOPS 1000
+
+/*
+ * Microbenchmark, print the cycles switch_to() spends on reprogramming
+ * PMP, which is the cost added to each context switch.
+ * It reads mcycle, so must be called in Machine mode, and it clobbers the
+ * PMP settings, which are loaded again by the next switch_to() anyway.
+ */
+void pmp_bench()
+{
+	struct mm *mm = &mm_idle;
+
+	reg_t start = r_mcycle();
+	for (int i = 0; i < BENCH_LOOPS; i++) {
+		w_pmpaddr0(mm->pmpaddr0);
+		w_pmpaddr1(mm->pmpaddr1);
+		w_pmpcfg0(mm->pmpcfg0);
+	}
+	reg_t cycles = r_mcycle() - start;
+
+	/* the empty loop */
+	start = r_mcycle();
+	for (int i = 0; i < BENCH_LOOPS; i++) {
+	}
+	reg_t base = r_mcycle() - start;
+
+	printf("pmp_bench: %u cycles per switch\n",
+	       (cycles - base) / BENCH_LOOPS);
 }
+#endif
 
 /*
  * DESCRIPTION
@@ -69,8 +702,14 @@ int task_create(void (*start_routin)(void))
  */
 void task_yield()
 {
-	/* trigger a machine-level software interrupt */
-	int id = r_mhartid();
+	/*
+	 * trigger a machine-level software interrupt
+	 * Notice tasks may run in User mode, where mhartid can not be read,
+	 * so we get the hart id from tp instead. But in a trap handler, e.g.
+	 * the yield and sleep syscalls, tp is whatever the user task left in
+	 * it, so read mhartid there.
+	 */
+	int id = in_trap() ? r_mhartid() : r_tp();
 	*(uint32_t*)CLINT_MSIP(id) = 1;
 }
 
@@ -1,29 +1,385 @@
 #include "os.h"
 #include "syscall.h"
+#include "meminfo.h"
+
+/* defined in usercopy.S */
+extern size_t __copy_user(void *dst, const void *src, size_t n);
+
+/* defined in ring.c */
+struct sys_ring;
+extern int sys_ring_enter(struct sys_ring *ring);
+
+/* defined in os.ld */
+extern uint8_t _memory_start[];
+extern uint8_t _memory_end[];
+
+/*
+ * DESCRIPTION
+ * 	Check if a user buffer lies in the RAM, and current task is allowed
+ * 	to access it (see task_access_ok()), so that a task can not make the
+ * 	kernel access memory on its behalf which it can not access by
+ * 	itself. A pointer passing the check may still fault, which is
+ * 	recovered by the exception table, see usercopy.S.
+ * 	If current task has a page table, the buffer is a virtual address,
+ * 	which is checked against the page table when it is translated by
+ * 	the copy routines, so only the wrap around is checked here.
+ * 	- type: VERIFY_READ or VERIFY_WRITE
+ * RETURN VALUE
+ * 	1 if ok, 0 if not.
+ */
+int access_ok(int type, const void *addr, size_t n)
+{
+	if ((reg_t)addr + n < (reg_t)addr) {
+		return 0;
+	}
+	if (task_pagetable()) {
+		return 1;
+	}
+
+	reg_t start = (reg_t)_memory_start;
+	reg_t size = (reg_t)_memory_end - start;
+	reg_t offset = (reg_t)addr - start;
+
+	/* offset wraps around if addr < start */
+	if (offset >= size || n > size - offset) {
+		return 0;
+	}
+	return task_access_ok((reg_t)addr, n, type == VERIFY_WRITE);
+}
+
+/*
+ * DESCRIPTION
+ * 	Copy n bytes from the kernel buffer src to the user buffer dst.
+ * RETURN VALUE
+ * 	number of bytes NOT copied, 0 on success.
+ */
+size_t copy_to_user(void *dst, const void *src, size_t n)
+{
+	if (!access_ok(VERIFY_WRITE, dst, n)) {
+		return n;
+	}
+	pagetable_t pt = task_pagetable();
+	if (pt) {
+		return uvm_copyout(pt, (reg_t)dst, src, n);
+	}
+	return __copy_user(dst, src, n);
+}
+
+/*
+ * DESCRIPTION
+ * 	Copy n bytes from the user buffer src to the kernel buffer dst.
+ * RETURN VALUE
+ * 	number of bytes NOT copied, 0 on success.
+ */
+size_t copy_from_user(void *dst, const void *src, size_t n)
+{
+	if (!access_ok(VERIFY_READ, src, n)) {
+		return n;
+	}
+	pagetable_t pt = task_pagetable();
+	if (pt) {
+		return uvm_copyin(pt, dst, (reg_t)src, n);
+	}
+	return __copy_user(dst, src, n);
+}
+
+/*
+ * DESCRIPTION
+ * 	Get the address of the user buffer [addr, addr + n) which the kernel
+ * 	can access directly, for the buffers shared by the kernel and a task.
+ * 	If current task has a page table, the buffer must not cross a page
+ * 	boundary. Access it with __copy_user(), since it may still fault.
+ * 	- type: VERIFY_READ or VERIFY_WRITE
+ * RETURN VALUE
+ * 	the address for the kernel, or NULL if the buffer is bad.
+ */
+void *user_ptr(int type, void *addr, size_t n)
+{
+	if (!access_ok(type, addr, n)) {
+		return NULL;
+	}
+	pagetable_t pt = task_pagetable();
+	if (pt) {
+		return uvm_ptr(pt, (reg_t)addr, n, type == VERIFY_WRITE);
+	}
+	return addr;
+}
 
 int sys_gethid(unsigned int *ptr_hid)
 {
-	printf("--> sys_gethid, arg0 = 0x%x\n", ptr_hid);
-	if (ptr_hid == NULL) {
+	pr_debug(DBG_SYSCALL, "--> sys_gethid, arg0 = 0x%x", ptr_hid);
+	unsigned int hid = r_mhartid();
+	if (copy_to_user(ptr_hid, &hid, sizeof(hid))) {
 		return -1;
-	} else {
-		*ptr_hid = r_mhartid();
-		return 0;
 	}
+	return 0;
 }
 
-void do_syscall(struct context *cxt)
+/*
+ * Data of read/write is passed through a buffer on the interrupt stack,
+ * which is small, so a large write is done a chunk at a time, and a read
+ * returns at most a chunk.
+ */
+#define SYSCALL_CHUNK_SIZE 64
+
+/*
+ * read from the console, only fd 0 is supported by now.
+ * The bytes taken from the receive buffer can not be given back, so the
+ * user buffer is written with zeroes first, and only as many bytes as it
+ * takes before a fault are read. Returns the number of bytes read, or -1
+ * if none because of a fault.
+ */
+int sys_read(int fd, char *buf, int n)
+{
+	char chunk[SYSCALL_CHUNK_SIZE];
+
+	if (fd != 0 || n <= 0 || !access_ok(VERIFY_WRITE, buf, n)) {
+		return -1;
+	}
+	if (n > SYSCALL_CHUNK_SIZE) {
+		n = SYSCALL_CHUNK_SIZE;
+	}
+	memset(chunk, 0, n);
+	n -= copy_to_user(buf, chunk, n);
+	if (0 == n) {
+		return -1;
+	}
+	n = uart_read(chunk, n);
+	size_t left = copy_to_user(buf, chunk, n);
+	if (left) {
+		/* bytes copied before the fault, or -1 if none */
+		return n - left ? n - left : -1;
+	}
+	return n;
+}
+
+/*
+ * Write to the console as much as the transmit buffer can take, without
+ * polling the UART with interrupts disabled. If nothing can be written
+ * and block is set, current task is blocked until there is room, and the
+ * syscall is issued again, see uart_write_nowait().
+ * Returns the number of bytes written, or -1 if none because of a fault.
+ */
+static int _write(int fd, const char *buf, int n, int block)
 {
-	uint32_t syscall_num = cxt->a7;
+	char chunk[SYSCALL_CHUNK_SIZE];
+
+	if ((fd != 1 && fd != 2) || n < 0 || !access_ok(VERIFY_READ, buf, n)) {
+		return -1;
+	}
+	int i;
+	for (i = 0; i < n; ) {
+		int len = n - i < SYSCALL_CHUNK_SIZE ? n - i : SYSCALL_CHUNK_SIZE;
+		size_t left = copy_from_user(chunk, buf + i, len);
+		int done = uart_write_nowait(chunk, len - left, block && 0 == i);
+		i += done;
+		if (done < len - left) {
+			/* the buffer is full, a short write */
+			return i;
+		}
+		if (left) {
+			/* bytes written before the fault, or -1 if none */
+			return i ? i : -1;
+		}
+	}
+	return n;
+}
+
+/*
+ * write to the console, fd 1 (stdout) and 2 (stderr) are the same.
+ * It may write less than n bytes if the console is busy.
+ */
+int sys_write(int fd, const char *buf, int n)
+{
+	return _write(fd, buf, n, 1);
+}
+
+/*
+ * the same as sys_write(), but it never blocks, for RING_OP_WRITE, since
+ * the batch can not be issued again.
+ */
+int sys_write_nowait(int fd, const char *buf, int n)
+{
+	return _write(fd, buf, n, 0);
+}
+
+/*
+ * sleep for at least ms milliseconds.
+ */
+int sys_sleep(unsigned int ms)
+{
+	task_sleep_until(get_mtime() + (uint64_t)ms * (CLINT_TIMEBASE_FREQ / 1000));
+	return 0;
+}
 
-	switch (syscall_num) {
-	case SYS_gethid:
-		cxt->a0 = sys_gethid((unsigned int *)(cxt->a0));
+int sys_yield(void)
+{
+	task_yield();
+	return 0;
+}
+
+int sys_exit(int status)
+{
+	pr_info("task %d exited with %d", task_getpid(), status);
+	task_exit();
+	return 0;
+}
+
+/*
+ * returns id of the child to the parent, and 0 to the child.
+ */
+int sys_fork(void)
+{
+	return task_fork();
+}
+
+/*
+ * get the usage statistics of the page allocator.
+ */
+int sys_meminfo(struct meminfo *info)
+{
+	struct meminfo mi;
+	page_meminfo(&mi);
+	if (copy_to_user(info, &mi, sizeof(mi))) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * print a report of the kernel to the console, for the debug commands of
+ * the console, what is one of REPORT_* in syscall.h.
+ */
+int sys_report(int what)
+{
+	switch (what) {
+	case REPORT_IRQ:
+		irq_report();
+		break;
+#ifdef CONFIG_STACK_PAINT
+	case REPORT_STACK:
+		stack_report();
+		break;
+#endif
+	case REPORT_SYSCALL:
+		syscall_report();
+		break;
+	case REPORT_MEM:
+		page_report();
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * set the log level, or the debug mask, for the debug commands of the
+ * console, what is one of SETLOG_* in syscall.h.
+ */
+int sys_setlog(int what, uint32_t value)
+{
+	switch (what) {
+	case SETLOG_LEVEL:
+		if (value > LOG_DEBUG) {
+			return -1;
+		}
+		log_set_level(value);
+		break;
+	case SETLOG_DEBUG:
+		debug_set_mask(value);
 		break;
 	default:
-		printf("Unknown syscall no: %d\n", syscall_num);
+		return -1;
+	}
+	return 0;
+}
+
+int sys_getpid(void)
+{
+	return task_getpid();
+}
+
+/*
+ * milliseconds since boot
+ */
+uint32_t sys_time(void)
+{
+	uint32_t rem;
+	return div_u64_rem(get_mtime(), CLINT_TIMEBASE_FREQ / 1000, &rem);
+}
+
+/*
+ * All the syscalls take their arguments from a0 ~ a5 of the context and
+ * return a value in a0, so each sys_<name>() is called by a wrapper
+ * __sys_<name>() with the common prototype syscall_t, which converts the
+ * registers to the types of the arguments listed in SYSCALL_TABLE, rather
+ * than calling sys_<name>() through a pointer of another type.
+ */
+typedef reg_t (*syscall_t)(struct context *cxt);
+
+#define SYSCALL_ARGS0()
+#define SYSCALL_ARGS1(t0)		(t0)cxt->a0
+#define SYSCALL_ARGS2(t0, t1)		SYSCALL_ARGS1(t0), (t1)cxt->a1
+#define SYSCALL_ARGS3(t0, t1, t2)	SYSCALL_ARGS2(t0, t1), (t2)cxt->a2
+
+#define SYSCALL_WRAPPER(num, name, nargs, ...)				\
+	static reg_t __sys_##name(struct context *cxt)			\
+	{								\
+		return (reg_t)sys_##name(SYSCALL_ARGS##nargs(__VA_ARGS__)); \
+	}
+
+SYSCALL_TABLE(SYSCALL_WRAPPER)
+
+/*
+ * The syscall table is indexed by the syscall number, a NULL entry means
+ * the number is not used. It is generated from SYSCALL_TABLE in syscall.h.
+ */
+#define SYSCALL_ENTRY(num, name, ...) [num] = __sys_##name,
+
+static const syscall_t syscall_table[] = {
+	SYSCALL_TABLE(SYSCALL_ENTRY)
+};
+
+#define NR_SYSCALLS (sizeof(syscall_table) / sizeof(syscall_table[0]))
+
+/* number of calls of each syscall */
+static uint32_t syscall_count[NR_SYSCALLS];
+
+/*
+ * DESCRIPTION:
+ *	Dispatch the syscall with number a7, called by the fast path of
+ *	ecall in entry.S, which saves the whole context of current task and
+ *	advances mepc over the ecall after we return.
+ *	The return value of the syscall is stored in a0 of the context, or -1
+ *	for an invalid syscall number.
+ */
+void do_syscall(struct context *cxt)
+{
+	reg_t syscall_num = cxt->a7;
+
+	trace_event(TRACE_SYSCALL_ENTER, syscall_num, cxt->a0);
+
+	if (syscall_num >= NR_SYSCALLS || NULL == syscall_table[syscall_num]) {
+		pr_warn("Unknown syscall no: %d", syscall_num);
 		cxt->a0 = -1;
+	} else {
+		syscall_count[syscall_num]++;
+		cxt->a0 = syscall_table[syscall_num](cxt);
 	}
 
-	return;
-}
\ No newline at end of file
+	trace_event(TRACE_SYSCALL_EXIT, syscall_num, cxt->a0);
+}
+
+/*
+ * DESCRIPTION:
+ *	Print the number of calls of each syscall which has ever been called.
+ */
+void syscall_report(void)
+{
+	for (int i = 0; i < NR_SYSCALLS; i++) {
+		if (syscall_count[i]) {
+			printf("syscall %d: count = %d\n", i, syscall_count[i]);
+		}
+	}
+}
@@ -1,2 +1,48 @@
 // System call numbers
 #define SYS_gethid	1
+#define SYS_read	2
+#define SYS_write	3
+#define SYS_sleep	4
+#define SYS_yield	5
+#define SYS_exit	6
+#define SYS_getpid	7
+#define SYS_time	8
+#define SYS_ring_enter	9
+#define SYS_fork	10
+#define SYS_meminfo	11
+#define SYS_report	12
+#define SYS_setlog	13
+
+/* what to print by the report syscall, see sys_report() */
+#define REPORT_IRQ	0
+#define REPORT_STACK	1
+#define REPORT_SYSCALL	2
+#define REPORT_MEM	3
+
+/* what to set by the setlog syscall, see sys_setlog() */
+#define SETLOG_LEVEL	0
+#define SETLOG_DEBUG	1
+
+/*
+ * The syscall table, X(number, name, nargs, types of the arguments...) for
+ * each syscall. It is expanded by syscall.c into the dispatch table of
+ * sys_<name>(), and by usys.S into the user mode stubs <name>(), so a new
+ * syscall only needs its number above, a line here, its sys_<name>() and
+ * its prototype in user_api.h.
+ * Keep it free of C code, it is included by assembly as well, the types
+ * are only expanded by syscall.c.
+ */
+#define SYSCALL_TABLE(X)						\
+	X(SYS_gethid,	gethid,	1, unsigned int *)			\
+	X(SYS_read,	read,	3, int, char *, int)			\
+	X(SYS_write,	write,	3, int, const char *, int)		\
+	X(SYS_sleep,	sleep,	1, unsigned int)			\
+	X(SYS_yield,	yield,	0)					\
+	X(SYS_exit,	exit,	1, int)					\
+	X(SYS_getpid,	getpid,	0)					\
+	X(SYS_time,	time,	0)					\
+	X(SYS_ring_enter, ring_enter, 1, struct sys_ring *)		\
+	X(SYS_fork,	fork,	0)					\
+	X(SYS_meminfo,	meminfo, 1, struct meminfo *)			\
+	X(SYS_report,	report,	1, int)					\
+	X(SYS_setlog,	setlog,	2, int, uint32_t)
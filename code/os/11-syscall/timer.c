@@ -19,6 +19,22 @@ void timer_load(int interval)
 	*(uint64_t*)CLINT_MTIMECMP(id) = *(uint64_t*)CLINT_MTIME + interval;
 }
 
+/*
+ * read mtime, which is 64 bits wide, with two 32-bit loads on RV32. Read
+ * the high word again to make sure the low word has not wrapped around
+ * between the loads. It reads memory only so works in User mode as well.
+ */
+uint64_t get_mtime(void)
+{
+	volatile uint32_t *mtime = (uint32_t *)CLINT_MTIME;
+	uint32_t hi, lo;
+	do {
+		hi = mtime[1];
+		lo = mtime[0];
+	} while (hi != mtime[1]);
+	return ((uint64_t)hi << 32) | lo;
+}
+
 void timer_init()
 {
 	struct timer *t = &(timer_list[0]);
@@ -89,11 +105,13 @@ void timer_delete(struct timer *timer)
 /* this routine should be called in interrupt context (interrupt is disabled) */
 static inline void timer_check()
 {
+	int fired = 0;
 	struct timer *t = &(timer_list[0]);
 	for (int i = 0; i < MAX_TIMER; i++) {
 		if (NULL != t->func) {
 			if (_tick >= t->timeout_tick) {
 				t->func(t->arg);
+				fired++;
 
 				/* once time, just delete it after timeout */
 				t->func = NULL;
@@ -104,16 +122,24 @@ static inline void timer_check()
 		}
 		t++;
 	}
+
+	trace_event(TRACE_TIMER_CHECK, _tick, fired);
 }
 
+/* called from timer_vector in entry.S for the machine timer interrupt. */
 void timer_handler() 
 {
+	trace_event(TRACE_TRAP_ENTER, 0x80000007, r_mepc());
+	pr_debug(DBG_TIMER, "timer interruption!");
+
 	_tick++;
-	printf("tick: %d\n", _tick);
+	pr_debug(DBG_TIMER, "tick: %d", _tick);
 
 	timer_check();
+	ring_timeout_check();
 
 	timer_load(TIMER_INTERVAL);
 
+	trace_event(TRACE_TRAP_EXIT, 0x80000007, r_mepc());
 	schedule();
 }
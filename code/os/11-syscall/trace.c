@@ -0,0 +1,53 @@
+#include "os.h"
+
+#ifdef CONFIG_TRACE
+
+/*
+ * Trace buffer
+ *
+ * A flight recorder of compact binary events (see TRACE_xxx in os.h),
+ * recorded by the tracepoints in the scheduler, trap handlers, timer and
+ * syscalls. There is no reader in the kernel, the buffer is dumped with
+ * gdb ("trace-dump" in ../gdbinit) and converted to a Chrome/Perfetto JSON
+ * timeline with trace2json.py on the host.
+ *
+ * The buffer is a ring, once it is full, the oldest events are overwritten.
+ * pos counts all the events ever recorded, each event takes its slot by
+ * atomically incrementing pos, so tracepoints in tasks and in (nested)
+ * trap handlers never wait for each other.
+ * Keep the layout in sync with trace2json.py.
+ */
+
+#define TRACE_EVENTS 1024	/* must be a power of 2 */
+
+struct trace_event {
+	uint64_t time;		/* mtime */
+	uint16_t hart;
+	uint16_t id;
+	uint32_t arg0;
+	uint32_t arg1;
+	int32_t pid;		/* current task, -1 for none (idle) */
+};
+
+struct trace {
+	uint32_t pos;
+	uint32_t size;
+	struct trace_event events[TRACE_EVENTS];
+};
+
+struct trace trace_buf = { 0, TRACE_EVENTS };
+
+void trace_event(int id, reg_t arg0, reg_t arg1)
+{
+	uint32_t pos = __atomic_fetch_add(&trace_buf.pos, 1, __ATOMIC_RELAXED);
+	struct trace_event *e = &trace_buf.events[pos & (TRACE_EVENTS - 1)];
+
+	e->time = get_mtime();
+	/* only called in Machine mode, where tp may still be the user's */
+	e->hart = r_mhartid();
+	e->id = id;
+	e->arg0 = arg0;
+	e->arg1 = arg1;
+	e->pid = task_getpid();
+}
+#endif
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+#
+# Convert the trace buffer of RVOS (see trace.c) dumped by gdb into a JSON
+# timeline, which can be opened with chrome://tracing or ui.perfetto.dev.
+#
+# Usage:
+#   (gdb) trace-dump
+#   $ ./trace2json.py trace.bin > trace.json
+
+import json
+import struct
+import sys
+
+# keep in sync with TRACE_xxx in os.h
+EVENTS = {
+    1: "schedule",
+    2: "switch_to",
+    3: "trap_enter",
+    4: "trap_exit",
+    5: "timer_check",
+    6: "syscall_enter",
+    7: "syscall_exit",
+}
+
+# keep in sync with struct trace_event in trace.c
+HEADER = struct.Struct("<II")
+EVENT = struct.Struct("<QHHIIi")
+
+# mtime runs at 10 MHz, JSON timestamps are in us
+TICKS_PER_US = 10
+
+
+def load(path):
+    data = open(path, "rb").read()
+    pos, size = HEADER.unpack_from(data, 0)
+    count = min(pos, size)
+    events = []
+    for seq in range(pos - count, pos):
+        off = HEADER.size + (seq % size) * EVENT.size
+        time, hart, eid, arg0, arg1, pid = EVENT.unpack_from(data, off)
+        events.append((time, hart, eid, arg0, arg1, pid))
+    # events of different harts may be recorded out of order
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+# the slices of trap_enter/exit and syscall_enter/exit
+SLICES = {
+    "trap_enter": ("B", lambda arg0: "trap %d" % (arg0 & 0xfff)),
+    "trap_exit": ("E", lambda arg0: "trap %d" % (arg0 & 0xfff)),
+    "syscall_enter": ("B", lambda arg0: "syscall %d" % arg0),
+    "syscall_exit": ("E", lambda arg0: "syscall %d" % arg0),
+}
+
+
+def task_name(pid):
+    return "idle" if pid < 0 else "task %d" % pid
+
+
+def convert(events):
+    """
+    Each task gets its own track for its traps and syscalls, since a task
+    may be switched out in the middle of one and another task enter its
+    own on the same hart, the idle task gets one per hart. A slice left
+    open when its task is switched out, e.g. a syscall which blocks and
+    is issued again, is closed at the switch, and an end with no slice
+    open is dropped, so the slices of a track always nest.
+    """
+    out = []
+    tracks = {}         # key of a task -> tid of its track
+    open_slices = {}    # key of a task -> names of its open slices
+    running = {}        # hart -> key of the task running on it
+    task_tracks = set()
+
+    def track(key, pid, hart):
+        if key not in tracks:
+            tid = 100 + pid if pid >= 0 else 2000 + hart
+            name = task_name(pid) if pid >= 0 else "idle, hart %d" % hart
+            tracks[key] = tid
+            out.append({"name": "thread_name", "ph": "M", "pid": 0,
+                        "tid": tid, "args": {"name": name}})
+        return tracks[key]
+
+    def close(key, ts, upto=None):
+        stack = open_slices.get(key, [])
+        while stack:
+            name = stack.pop()
+            out.append({"name": name, "ph": "E", "ts": ts, "pid": 0,
+                        "tid": tracks[key]})
+            if name == upto:
+                break
+
+    for time, hart, eid, arg0, arg1, pid in events:
+        name = EVENTS.get(eid, "event %d" % eid)
+        ts = time / TICKS_PER_US
+        # the idle task runs on all the harts at a time
+        key = pid if pid >= 0 else ("idle", hart)
+        ev = {
+            "name": name,
+            "ts": ts,
+            "pid": 0,
+            "tid": hart,
+            "args": {"arg0": arg0, "arg1": arg1},
+        }
+
+        if name in SLICES:
+            ph, slice_name = SLICES[name]
+            ev.update(ph=ph, name=slice_name(arg0),
+                      tid=track(key, pid, hart))
+            stack = open_slices.setdefault(key, [])
+            if ph == "B":
+                stack.append(ev["name"])
+                out.append(ev)
+            elif ev["name"] in stack:
+                close(key, ts, upto=ev["name"])
+            continue
+
+        ev.update(ph="i", s="t")
+        out.append(ev)
+
+        # show which task is running on a separate track of each hart
+        if name == "switch_to":
+            if hart in running:
+                close(running[hart], ts)
+            next_pid = arg0 if arg0 != 0xffffffff else -1
+            running[hart] = next_pid if next_pid >= 0 else ("idle", hart)
+
+            tid = 1000 + hart
+            if tid in task_tracks:
+                out.append({"name": "task", "ph": "E", "ts": ts,
+                            "pid": 0, "tid": tid})
+            task_tracks.add(tid)
+            out.append({"name": task_name(next_pid), "ph": "B", "ts": ts,
+                        "pid": 0, "tid": tid})
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write("usage: %s trace.bin\n" % sys.argv[0])
+        sys.exit(1)
+    json.dump(convert(load(sys.argv[1])), sys.stdout, indent=1)
+
+
+if __name__ == "__main__":
+    main()
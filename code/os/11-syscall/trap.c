@@ -1,74 +1,223 @@
 #include "os.h"
 
-extern void trap_vector(void);
-extern void uart_isr(void);
+extern void trap_vector_table(void);
 extern void timer_handler(void);
 extern void schedule(void);
-extern void do_syscall(struct context *cxt);
+
+/* defined in start.S, reused as the interrupt stacks of harts */
+extern uint8_t stacks[];
 
 void trap_init()
 {
 	/*
-	 * set the trap-vector base-address for machine-mode
+	 * set the trap-vector base-address for machine-mode, in vectored
+	 * mode, so each interrupt goes to its own entry in the vector table.
 	 */
-	w_mtvec((reg_t)trap_vector);
+	w_mtvec((reg_t)trap_vector_table | MTVEC_MODE_VECTORED);
+}
+
+/*
+ * DESCRIPTION
+ *	Check if we are in a trap handler (or still booting), which can not
+ *	wait for anything done by interrupts. Trap handlers and the boot code
+ *	run on the stack of the hart, while tasks run on their own stacks.
+ *	Notice this works in User mode as well, because no CSR is read.
+ * RETURN VALUE
+ *	1: in a trap handler or booting
+ *	0: in a task
+ */
+int in_trap()
+{
+	reg_t sp = r_sp();
+	return (sp > (reg_t)stacks &&
+		sp <= (reg_t)&stacks[HART_STACK_SIZE * MAXNUM_CPU]);
+}
+
+/*
+ * max number of interrupts served by external_interrupt_handler() in one
+ * trap, could be overridden with -D IRQ_MAX_BATCH=n.
+ */
+#ifndef IRQ_MAX_BATCH
+#define IRQ_MAX_BATCH 8
+#endif
+
+#ifdef CONFIG_NESTED_IRQ
+/*
+ * state of the hart which has to be kept while interrupts are nested
+ */
+struct irq_state {
+	reg_t mepc;
+	reg_t mstatus;
+	reg_t mie;
+	int threshold;
+};
+
+/*
+ * DESCRIPTION
+ *	Allow interrupts with higher priority than irq to preempt the handler
+ *	of irq. The PLIC threshold is raised to the priority of irq, so only
+ *	higher priority sources can be taken. Timer and software interrupts
+ *	are kept disabled because their handlers switch task. mepc and mstatus
+ *	are saved in state, because they will be overwritten by nested traps.
+ */
+static void irq_nest_enable(int irq, struct irq_state *state)
+{
+	state->mepc = r_mepc();
+	state->mstatus = r_mstatus();
+	state->mie = r_mie();
+	state->threshold = plic_get_threshold();
+
+	plic_set_threshold(plic_get_priority(irq));
+	w_mie(state->mie & ~(MIE_MTIE | MIE_MSIE));
+	w_mstatus(state->mstatus | MSTATUS_MIE);
+}
+
+/* the counterpart of irq_nest_enable */
+static void irq_nest_disable(struct irq_state *state)
+{
+	w_mstatus(state->mstatus);
+	w_mie(state->mie);
+	plic_set_threshold(state->threshold);
+	w_mepc(state->mepc);
 }
+#endif
 
+/*
+ * called from external_vector in entry.S for the machine external interrupt,
+ * either taken from a task or, if CONFIG_NESTED_IRQ is enabled, preempting
+ * the handler of an interrupt with lower priority.
+ */
 void external_interrupt_handler()
 {
-	int irq = plic_claim();
+	trace_event(TRACE_TRAP_ENTER, 0x8000000b, r_mepc());
+	pr_debug(DBG_IRQ, "external interruption!");
+
+	/*
+	 * Keep claiming until the PLIC has nothing pending, so a burst of
+	 * device interrupts is served within one trap, but serve at most
+	 * IRQ_MAX_BATCH of them, so the interrupted task is not starved.
+	 * Anything left will raise a new trap as soon as we return.
+	 */
+	for (int n = 0; n < IRQ_MAX_BATCH; n++) {
+		int irq = plic_claim();
+		if (!irq) {
+			break;
+		}
+
+#ifdef CONFIG_NESTED_IRQ
+		struct irq_state state;
+		irq_nest_enable(irq, &state);
+#endif
+		int ret = irq_dispatch(irq);
+#ifdef CONFIG_NESTED_IRQ
+		irq_nest_disable(&state);
+#endif
+		if (ret) {
+			pr_warn("unexpected interrupt irq = %d", irq);
+		}
 
-	if (irq == UART0_IRQ){
-      		uart_isr();
-	} else if (irq) {
-		printf("unexpected interrupt irq = %d\n", irq);
-	}
-	
-	if (irq) {
 		plic_complete(irq);
 	}
+
+	trace_event(TRACE_TRAP_EXIT, 0x8000000b, r_mepc());
 }
 
+/*
+ * called from soft_vector in entry.S for the machine software interrupt.
+ */
+void software_interrupt_handler()
+{
+	trace_event(TRACE_TRAP_ENTER, 0x80000003, r_mepc());
+	pr_debug(DBG_SCHED, "software interruption!");
+	/*
+	 * acknowledge the software interrupt by clearing
+	 * the MSIP bit in mip.
+	 */
+	int id = r_mhartid();
+	*(uint32_t*)CLINT_MSIP(id) = 0;
+
+	trace_event(TRACE_TRAP_EXIT, 0x80000003, r_mepc());
+	schedule();
+}
+
+/* the exception table, see usercopy.S */
+struct exception_table_entry {
+	reg_t insn;
+	reg_t fixup;
+};
+
+extern struct exception_table_entry _ex_table_start[];
+extern struct exception_table_entry _ex_table_end[];
+
+/*
+ * DESCRIPTION
+ * 	Look up the instruction at epc in the exception table.
+ * RETURN VALUE
+ * 	the address of the fixup code, or 0 if epc is not in the table.
+ */
+static reg_t search_exception_table(reg_t epc)
+{
+	struct exception_table_entry *e;
+	for (e = _ex_table_start; e < _ex_table_end; e++) {
+		if (e->insn == epc) {
+			return e->fixup;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Software, timer and external interrupts in machine mode have their own
+ * entries in the vector table, and ecall from U-mode takes a fast path in
+ * trap_vector straight to do_syscall(), so only other exceptions and
+ * unexpected interrupts come here.
+ */
 reg_t trap_handler(reg_t epc, reg_t cause, struct context *cxt)
 {
 	reg_t return_pc = epc;
 	reg_t cause_code = cause & 0xfff;
+
+	trace_event(TRACE_TRAP_ENTER, cause, epc);
 	
 	if (cause & 0x80000000) {
 		/* Asynchronous trap - interrupt */
-		switch (cause_code) {
-		case 3:
-			uart_puts("software interruption!\n");
-			/*
-			 * acknowledge the software interrupt by clearing
-    			 * the MSIP bit in mip.
-			 */
-			int id = r_mhartid();
-    			*(uint32_t*)CLINT_MSIP(id) = 0;
-
-			schedule();
-
-			break;
-		case 7:
-			uart_puts("timer interruption!\n");
-			timer_handler();
-			break;
-		case 11:
-			uart_puts("external interruption!\n");
-			external_interrupt_handler();
-			break;
-		default:
-			uart_puts("unknown async exception!\n");
-			break;
-		}
+		pr_warn("unknown async exception!, code = %d", cause_code);
 	} else {
 		/* Synchronous trap - exception */
-		printf("Sync exceptions!, code = %d\n", cause_code);
+		pr_debug(DBG_TRAP, "Sync exceptions!, code = %d", cause_code);
 		switch (cause_code) {
-		case 8:
-			uart_puts("System call from U-mode!\n");
-			do_syscall(cxt);
-			return_pc += 4;
+		case 12:	/* instruction page fault */
+		case 13:	/* load page fault */
+		case 15:	/* store/AMO page fault */
+			if (0 == (r_mstatus() & MSTATUS_MPP)) {
+				/* from User mode, demand paging or copy-on-write */
+				if (0 == task_page_fault(r_mtval(), 15 == cause_code)) {
+					break;
+				}
+				pr_err("task %d: bad access to 0x%x, pc = 0x%x",
+				       task_getpid(), r_mtval(), epc);
+				task_exit();
+			}
+			/* fall through */
+		case 1:		/* instruction access fault */
+		case 5:		/* load access fault */
+		case 7:		/* store/AMO access fault */
+			/*
+			 * a bad user pointer in copy_to_user()/copy_from_user()
+			 * goes on with the fixup code instead.
+			 */
+			return_pc = search_exception_table(epc);
+			if (return_pc) {
+				pr_debug(DBG_TRAP, "fixup 0x%x -> 0x%x", epc, return_pc);
+				break;
+			}
+			if (0 == (r_mstatus() & MSTATUS_MPP)) {
+				/* a task out of its PMP regions, only kill the task */
+				pr_err("task %d: access fault at 0x%x, pc = 0x%x",
+				       task_getpid(), r_mtval(), epc);
+				task_exit();
+			}
+			panic("OOPS! What can I do!");
 			break;
 		default:
 			panic("OOPS! What can I do!");
@@ -76,6 +225,7 @@ reg_t trap_handler(reg_t epc, reg_t cause, struct context *cxt)
 		}
 	}
 
+	trace_event(TRACE_TRAP_EXIT, cause, return_pc);
 	return return_pc;
 }
 
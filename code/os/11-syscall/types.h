@@ -6,6 +6,9 @@ typedef unsigned short uint16_t;
 typedef unsigned int  uint32_t;
 typedef unsigned long long uint64_t;
 
+/* an integer as wide as a pointer, unsigned long is on both RV32 and LP64 */
+typedef unsigned long uintptr_t;
+
 /*
  * RISCV32: register is 32bits width
  */ 
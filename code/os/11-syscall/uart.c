@@ -63,6 +63,43 @@
 #define LSR_RX_READY (1 << 0)
 #define LSR_TX_IDLE  (1 << 5)
 
+/*
+ * INTERRUPT ENABLE REGISTER (IER)
+ * IER BIT 0: 1 = enable the receiver ready interrupt.
+ * IER BIT 1: 1 = enable the transmitter empty interrupt.
+ */
+#define IER_RX_ENABLE (1 << 0)
+#define IER_TX_ENABLE (1 << 1)
+
+/*
+ * FIFO CONTROL REGISTER (FCR)
+ * FCR BIT 0: 1 = enable the transmit and receive FIFO.
+ * FCR BIT 1: 1 = clear the receive FIFO.
+ * FCR BIT 2: 1 = clear the transmit FIFO.
+ * FCR BIT 6-7: receive trigger level, the receiver ready interrupt is
+ * raised once there are so many bytes in the receive FIFO, or no more byte
+ * has arrived for a while (time-out).
+ */
+#define FCR_FIFO_ENABLE (1 << 0)
+#define FCR_FIFO_CLEAR  (3 << 1)
+#define FCR_RX_TRIGGER_1  (0 << 6)
+#define FCR_RX_TRIGGER_4  (1 << 6)
+#define FCR_RX_TRIGGER_8  (2 << 6)
+#define FCR_RX_TRIGGER_14 (3 << 6)
+
+/* both the transmit and receive FIFO of 16550 are 16 bytes */
+#define UART_FIFO_SIZE 16
+
+/*
+ * receive trigger level, could be overridden with
+ * -D UART_RX_TRIGGER=FCR_RX_TRIGGER_x.
+ * A higher level means less interrupts for bulk input, while the time-out
+ * still makes sure a single key stroke is not left in the FIFO.
+ */
+#ifndef UART_RX_TRIGGER
+#define UART_RX_TRIGGER FCR_RX_TRIGGER_8
+#endif
+
 #define uart_read_reg(reg) (*(UART_REG(reg)))
 #define uart_write_reg(reg, v) (*(UART_REG(reg)) = (v))
 
@@ -104,23 +141,241 @@ void uart_init()
 	uart_write_reg(LCR, lcr | (3 << 0));
 
 	/*
-	 * enable receive interrupts.
+	 * enable and clear the FIFOs, and set the receive trigger level.
 	 */
-	uint8_t ier = uart_read_reg(IER);
-	uart_write_reg(IER, ier | (1 << 0));
+	uart_write_reg(FCR, FCR_FIFO_ENABLE | FCR_FIFO_CLEAR | UART_RX_TRIGGER);
+
+	/*
+	 * enable receive interrupts. transmit interrupts are only enabled
+	 * when there is something in the transmit buffer, see uart_tx_kick().
+	 */
+	uart_write_reg(IER, IER_RX_ENABLE);
+}
+
+/*
+ * Transmit buffer
+ *
+ * Writers (tasks and trap handlers, maybe nested) put bytes into a ring
+ * buffer and return at once, the buffer is drained by the transmitter empty
+ * interrupt. It is lock-free, because tasks run in User mode and can not
+ * disable interrupts:
+ * - writers reserve a range of slots by moving tx_head forward with CAS,
+ *   then fill the slots and mark each of them ready.
+ * - the only reader at a time (see tx_drain_lock) sends ready slots in order
+ *   and moves tx_tail forward, it stops at a slot which has been reserved
+ *   but not filled yet, e.g. by a task which is preempted, and the writer
+ *   kicks the transmitter again once it has filled the slot.
+ * Positions are free running counters, the size must be a power of 2.
+ */
+#define UART_TX_BUF_SIZE 1024
+#define UART_TX_BUF_MASK (UART_TX_BUF_SIZE - 1)
+
+static char tx_buf[UART_TX_BUF_SIZE];
+static uint8_t tx_ready[UART_TX_BUF_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static int tx_drain_lock = 0;
+
+/* number of bytes dropped because the buffer was full in a trap handler */
+static uint32_t tx_dropped = 0;
+
+/*
+ * reserve at most n slots, return the number of slots actually reserved,
+ * and the position of the first one via pos.
+ */
+static int tx_reserve(int n, uint32_t *pos)
+{
+	uint32_t head = __atomic_load_n(&tx_head, __ATOMIC_RELAXED);
+	do {
+		uint32_t tail = __atomic_load_n(&tx_tail, __ATOMIC_ACQUIRE);
+		uint32_t room = UART_TX_BUF_SIZE - (head - tail);
+		if (room == 0) {
+			return 0;
+		}
+		if (n > room) {
+			n = room;
+		}
+	} while (!__atomic_compare_exchange_n(&tx_head, &head, head + n, 1,
+					      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	*pos = head;
+	return n;
+}
+
+/* get the next byte to send, return 0 if there is no byte ready */
+static int tx_pop(char *ch)
+{
+	uint32_t i = tx_tail & UART_TX_BUF_MASK;
+	if (!__atomic_load_n(&tx_ready[i], __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*ch = tx_buf[i];
+	tx_ready[i] = 0;
+	__atomic_store_n(&tx_tail, tx_tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static inline int tx_empty()
+{
+	return !__atomic_load_n(&tx_ready[tx_tail & UART_TX_BUF_MASK],
+				__ATOMIC_ACQUIRE);
+}
+
+/* make sure the transmitter empty interrupt will come */
+static inline void uart_tx_kick()
+{
+	uart_write_reg(IER, IER_RX_ENABLE | IER_TX_ENABLE);
+}
+
+/*
+ * Send ready bytes while the transmitter can take them, must be called
+ * with tx_drain_lock held. If poll is set, wait for the transmitter instead
+ * of leaving the rest to the next transmitter empty interrupt, until n bytes
+ * have been sent or the buffer is empty.
+ * In FIFO mode, LSR_TX_IDLE means the whole transmit FIFO is empty, so
+ * we can fill it with UART_FIFO_SIZE bytes at once without checking LSR
+ * for every byte.
+ * RETURN VALUE: number of bytes sent.
+ */
+static int tx_drain(int poll, int n)
+{
+	char ch;
+	int sent = 0;
+	while (n > 0) {
+		if ((uart_read_reg(LSR) & LSR_TX_IDLE) == 0) {
+			if (poll) {
+				continue;
+			}
+			break;
+		}
+		for (int i = 0; i < UART_FIFO_SIZE && n > 0; i++, n--) {
+			if (!tx_pop(&ch)) {
+				return sent;
+			}
+			uart_write_reg(THR, ch);
+			sent++;
+		}
+	}
+	return sent;
+}
+
+static inline int tx_drain_trylock()
+{
+	return !__atomic_exchange_n(&tx_drain_lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void tx_drain_unlock()
+{
+	__atomic_store_n(&tx_drain_lock, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * The buffer is full, wait for some room.
+ * A task just waits for the transmitter empty interrupt to drain the
+ * buffer. A trap handler can not wait for interrupts, so it drains the
+ * buffer itself by polling. Nothing can be done but drop the output if:
+ * - the buffer is being drained by the handler we have preempted.
+ * - nothing can be drained, because the next slot has been reserved by a
+ *   writer which is preempted before filling it, and which can not run
+ *   again until we return.
+ * RETURN VALUE: 0 if the caller should try again, -1 if it should drop.
+ */
+static int tx_wait()
+{
+	if (!in_trap()) {
+		return 0;
+	}
+	if (!tx_drain_trylock()) {
+		tx_dropped++;
+		return -1;
+	}
+	int sent = tx_drain(1, UART_TX_BUF_SIZE / 2);
+	tx_drain_unlock();
+	/* the interrupt may have been disabled while we were draining */
+	uart_tx_kick();
+	if (0 == sent) {
+		tx_dropped++;
+		return -1;
+	}
+	return 0;
+}
+
+void uart_write(const char *s, int len)
+{
+	while (len > 0) {
+		uint32_t pos;
+		int n = tx_reserve(len, &pos);
+		if (n == 0) {
+			if (tx_wait()) {
+				return;
+			}
+			continue;
+		}
+		for (int i = 0; i < n; i++) {
+			uint32_t j = (pos + i) & UART_TX_BUF_MASK;
+			tx_buf[j] = s[i];
+			__atomic_store_n(&tx_ready[j], 1, __ATOMIC_RELEASE);
+		}
+		s += n;
+		len -= n;
+		uart_tx_kick();
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Put at most len bytes into the buffer, but never wait for room, for
+ * 	the write syscall, which runs with interrupts disabled, so it must
+ * 	not poll the UART for a large buffer.
+ * 	If block is set and the buffer is full, current task is blocked until
+ * 	the transmitter empty interrupt makes room, so the syscall is issued
+ * 	again then, see task_sleep(). This never returns in that case.
+ * RETURN VALUE
+ * 	number of bytes put into the buffer, 0 if it is full.
+ */
+int uart_write_nowait(const char *s, int len, int block)
+{
+	uint32_t pos;
+	int n = tx_reserve(len, &pos);
+	if (n == 0) {
+		if (block) {
+			task_sleep(&tx_tail);
+		}
+		return 0;
+	}
+	for (int i = 0; i < n; i++) {
+		uint32_t j = (pos + i) & UART_TX_BUF_MASK;
+		tx_buf[j] = s[i];
+		__atomic_store_n(&tx_ready[j], 1, __ATOMIC_RELEASE);
+	}
+	uart_tx_kick();
+	return n;
 }
 
 int uart_putc(char ch)
 {
-	while ((uart_read_reg(LSR) & LSR_TX_IDLE) == 0);
-	return uart_write_reg(THR, ch);
+	uart_write(&ch, 1);
+	return ch;
 }
 
 void uart_puts(char *s)
 {
-	while (*s) {
-		uart_putc(*s++);
+	int len = 0;
+	while (s[len]) {
+		len++;
 	}
+	uart_write(s, len);
+}
+
+/*
+ * Send all the output in the buffer out by polling, for the case that no
+ * interrupt will come any more, e.g. panic.
+ */
+void uart_flush(void)
+{
+	/* take over the buffer anyway, we are not going to give it back */
+	tx_drain_trylock();
+	tx_drain(1, UART_TX_BUF_SIZE);
+	tx_drain_unlock();
 }
 
 int uart_getc(void)
@@ -133,17 +388,132 @@ int uart_getc(void)
 }
 
 /*
- * handle a uart interrupt, raised because input has arrived, called from trap.c.
+ * Receive buffer with a simple line discipline
+ *
+ * Input is echoed and assembled into lines by the receiver interrupt, a
+ * line can be edited with backspace until it is committed by enter, then
+ * it is ready to be read by uart_read(). Like the transmit buffer, the
+ * positions are free running counters:
+ * - rx_r: next byte to be read
+ * - rx_w: end of the committed lines, which are ready to be read
+ * - rx_e: end of the line being edited
  */
-void uart_isr(void)
+#define UART_RX_BUF_SIZE 128
+
+static char rx_buf[UART_RX_BUF_SIZE];
+static uint32_t rx_r = 0;
+static uint32_t rx_w = 0;
+static uint32_t rx_e = 0;
+
+#define BACKSPACE	'\b'
+#define DEL		0x7f
+
+static void uart_rx(char ch)
+{
+	switch (ch) {
+	case BACKSPACE:
+	case DEL:
+		if (rx_e != rx_w) {
+			rx_e--;
+			uart_puts("\b \b");
+		}
+		break;
+	default:
+		if (rx_e - rx_r >= UART_RX_BUF_SIZE) {
+			/* no room, drop it */
+			break;
+		}
+		/* enter is sent as '\r' by the terminal */
+		if (ch == '\r') {
+			ch = '\n';
+		}
+		rx_buf[rx_e++ % UART_RX_BUF_SIZE] = ch;
+		uart_putc(ch);
+		/*
+		 * commit the line if enter is pressed or the buffer is full,
+		 * and wake up the readers.
+		 */
+		if (ch == '\n' || rx_e - rx_r == UART_RX_BUF_SIZE) {
+			rx_w = rx_e;
+			task_wakeup(&rx_w);
+		}
+	}
+}
+
+/*
+ * DESCRIPTION
+ * 	Read at most n bytes of input into buf, stop at the end of a line.
+ * 	If no line is ready, current task is blocked until one is committed,
+ * 	so this must be called from a syscall, see task_sleep().
+ * RETURN VALUE
+ * 	number of bytes read
+ */
+int uart_read(char *buf, int n)
+{
+	if (rx_r == rx_w) {
+		task_sleep(&rx_w);
+	}
+
+	int i = 0;
+	while (i < n && rx_r != rx_w) {
+		char ch = rx_buf[rx_r++ % UART_RX_BUF_SIZE];
+		buf[i++] = ch;
+		if (ch == '\n') {
+			break;
+		}
+	}
+	return i;
+}
+
+/*
+ * handle the transmitter empty interrupt
+ */
+static void uart_tx_isr()
+{
+	if (!tx_drain_trylock()) {
+		/*
+		 * the buffer is being drained by the handler we have preempted,
+		 * which will kick the transmitter again when it finishes.
+		 */
+		uart_write_reg(IER, IER_RX_ENABLE);
+		return;
+	}
+
+	if (tx_drain(0, UART_TX_BUF_SIZE)) {
+		/* wake up the writers blocked in uart_write_nowait() */
+		task_wakeup(&tx_tail);
+	}
+	if (tx_empty()) {
+		/*
+		 * Nothing more to send, disable the transmitter empty interrupt,
+		 * or it would be raised again and again.
+		 * Check again after that, in case some writer has preempted us
+		 * and kicked the transmitter just before we disable it.
+		 */
+		uart_write_reg(IER, IER_RX_ENABLE);
+		if (!tx_empty()) {
+			uart_tx_kick();
+		}
+	}
+
+	tx_drain_unlock();
+}
+
+/*
+ * handle a uart interrupt, raised because input has arrived or the
+ * transmitter is empty, called from trap.c.
+ * All the bytes in the receive FIFO are read in one interrupt.
+ */
+void uart_isr(void *arg)
 {
 	while (1) {
 		int c = uart_getc();
 		if (c == -1) {
 			break;
 		} else {
-			uart_putc((char)c);
-			uart_putc('\n');
+			uart_rx((char)c);
 		}
 	}
+
+	uart_tx_isr();
 }
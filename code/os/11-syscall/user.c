@@ -1,12 +1,64 @@
 #include "os.h"
 
 #include "user_api.h"
+#include "syscall.h"
+#include "ring.h"
+#include "meminfo.h"
 
 #define DELAY 4000
 
+/*
+ * With CONFIG_PMP, tasks can access neither the UART nor the data of the
+ * kernel, so they print through the write syscall.
+ */
+#ifdef CONFIG_SYSCALL
+/* write() may be short if the console is busy, so write the rest again */
+static int write_all(const char *buf, int n)
+{
+	int i = 0;
+	while (i < n) {
+		int ret = write(1, buf + i, n - i);
+		if (ret < 0) {
+			return ret;
+		}
+		i += ret;
+	}
+	return n;
+}
+
+static void user_puts(const char *s)
+{
+	int n = 0;
+	while (s[n]) {
+		n++;
+	}
+	write_all(s, n);
+}
+
+static int user_printf(const char *fmt, ...)
+{
+	char buf[128];
+	va_list vl;
+	va_start(vl, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, vl);
+	va_end(vl);
+	if (n > sizeof(buf) - 1) {
+		n = sizeof(buf) - 1;
+	}
+	return write_all(buf, n);
+}
+
+/* sleep rather than spin, so the idle task gets the CPU in between */
+#define user_delay() sleep(1000)
+#else
+#define user_puts uart_puts
+#define user_printf printf
+#define user_delay() task_delay(DELAY)
+#endif
+
 void user_task0(void)
 {
-	uart_puts("Task 0: Created!\n");
+	user_puts("Task 0: Created!\n");
 
 	unsigned int hid = -1;
 
@@ -22,31 +74,281 @@ void user_task0(void)
 	ret = gethid(&hid);
 	//ret = gethid(NULL);
 	if (!ret) {
-		printf("system call returned!, hart id is %d\n", hid);
+		user_printf("system call returned!, hart id is %d\n", hid);
 	} else {
-		printf("gethid() failed, return: %d\n", ret);
+		user_printf("gethid() failed, return: %d\n", ret);
 	}
 #endif
 
 	while (1){
-		uart_puts("Task 0: Running... \n");
-		task_delay(DELAY);
+		user_puts("Task 0: Running... \n");
+		user_delay();
 	}
 }
 
 void user_task1(void)
 {
-	uart_puts("Task 1: Created!\n");
+	user_puts("Task 1: Created!\n");
+	while (1) {
+		user_puts("Task 1: Running... \n");
+		user_delay();
+	}
+}
+
+#ifdef CONFIG_SYSCALL
+/* if the line is the command cmd, followed by the end of line */
+static int is_cmd(const char *line, const char *cmd)
+{
+	while (*cmd && *line == *cmd) {
+		line++;
+		cmd++;
+	}
+	return 0 == *cmd && ('\n' == *line || '\r' == *line || 0 == *line);
+}
+
+/* the argument of the command cmd in the line, or NULL if it is not cmd */
+static const char *cmd_arg(const char *line, const char *cmd)
+{
+	while (*cmd && *line == *cmd) {
+		line++;
+		cmd++;
+	}
+	if (*cmd || ' ' != *line) {
+		return NULL;
+	}
+	while (' ' == *line) {
+		line++;
+	}
+	return line;
+}
+
+/*
+ * parse a number up to the end of line, in decimal, or in hex with 0x,
+ * return -1 if it is not a number.
+ */
+static int parse_num(const char *s, unsigned int *val)
+{
+	unsigned int base = 10;
+	unsigned int v = 0;
+	if ('0' == s[0] && ('x' == s[1] || 'X' == s[1])) {
+		base = 16;
+		s += 2;
+	}
+
+	const char *start = s;
+	for (; *s && '\n' != *s && '\r' != *s; s++) {
+		char c = *s | 0x20;	/* lower case */
+		unsigned int d;
+		if (*s >= '0' && *s <= '9') {
+			d = *s - '0';
+		} else if (16 == base && c >= 'a' && c <= 'f') {
+			d = c - 'a' + 10;
+		} else {
+			return -1;
+		}
+		v = v * base + d;
+	}
+	if (s == start) {
+		return -1;
+	}
+	*val = v;
+	return 0;
+}
+
+/*
+ * Echo the lines entered, except the debug commands:
+ * - meminfo: print the usage statistics and the fragmentation of the page
+ *   allocator
+ * - irqs: print the counters of the interrupt sources
+ * - stacks: print the stack usage of the tasks, with STACK_PAINT=y
+ * - syscalls: print the number of calls of each syscall
+ * - loglevel <n>: discard the kernel messages with a level greater than n,
+ *   0 (LOG_ERR) ~ 3 (LOG_DEBUG)
+ * - debug <mask>: turn on the debug messages of the subsystems in mask,
+ *   DBG_* in os.h, with DEBUG=y
+ */
+void user_task2(void)
+{
+	user_puts("Task 2: Created!\n");
+
+	char line[64];
+	const char *arg;
+	unsigned int val;
 	while (1) {
-		uart_puts("Task 1: Running... \n");
-		task_delay(DELAY);
+		/* block here until a line is entered */
+		int n = read(0, line, sizeof(line) - 1);
+		if (n < 0) {
+			continue;
+		}
+		line[n] = 0;
+		if (is_cmd(line, "meminfo")) {
+			report(REPORT_MEM);
+			continue;
+		}
+		if (is_cmd(line, "irqs")) {
+			report(REPORT_IRQ);
+			continue;
+		}
+		if (is_cmd(line, "stacks")) {
+			if (report(REPORT_STACK) < 0) {
+				user_puts("Task 2: stacks needs STACK_PAINT=y\n");
+			}
+			continue;
+		}
+		if (is_cmd(line, "syscalls")) {
+			report(REPORT_SYSCALL);
+			continue;
+		}
+		if ((arg = cmd_arg(line, "loglevel"))) {
+			if (parse_num(arg, &val) < 0 ||
+			    setlog(SETLOG_LEVEL, val) < 0) {
+				user_puts("Task 2: usage: loglevel <0 ~ 3>\n");
+			}
+			continue;
+		}
+		if ((arg = cmd_arg(line, "debug"))) {
+			if (parse_num(arg, &val) < 0 ||
+			    setlog(SETLOG_DEBUG, val) < 0) {
+				user_puts("Task 2: usage: debug <mask>\n");
+			}
+			continue;
+		}
+		user_printf("Task 2: read %d bytes: %s", n, line);
+	}
+}
+
+#define SYSCALL_LOOPS 10000
+
+/* put an operation into the sq, the caller makes sure it is not full */
+static void ring_submit(struct sys_ring *ring, uint32_t opcode, int fd,
+			const void *addr, uint32_t len, uint32_t user_data)
+{
+	struct ring_sqe *sqe = &ring->sq[ring->sq_tail % RING_ENTRIES];
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint32_t)addr;
+	sqe->len = len;
+	sqe->user_data = user_data;
+	ring->sq_tail++;
+}
+
+/* reap all the completions, return the number of errors */
+static int ring_reap(struct sys_ring *ring)
+{
+	int errors = 0;
+	while (ring->cq_head != ring->cq_tail) {
+		if (ring->cq[ring->cq_head % RING_ENTRIES].res < 0) {
+			errors++;
+		}
+		ring->cq_head++;
+	}
+	return errors;
+}
+
+/*
+ * A task using syscalls only, no M-mode privileges needed at all.
+ * The ring is put in the heap of the task.
+ */
+void user_task3(void *heap)
+{
+	char msg[64];
+	int pid = getpid();
+	struct sys_ring *ring = heap;
+
+	ring->sq_head = ring->sq_tail = 0;
+	ring->cq_head = ring->cq_tail = 0;
+	ring->cq_overflow = 0;
+
+	/* measure the round-trip of a syscall */
+	unsigned int start = time();
+	for (int i = 0; i < SYSCALL_LOOPS; i++) {
+		getpid();
+	}
+	unsigned int ms = time() - start;
+	int n = snprintf(msg, sizeof(msg), "Task %d: %d syscalls in %d ms\n",
+			 pid, SYSCALL_LOOPS, ms);
+	write_all(msg, n);
+
+	/* the same number of operations, in batches of RING_ENTRIES */
+	start = time();
+	for (int i = 0; i < SYSCALL_LOOPS; i += RING_ENTRIES) {
+		for (int j = 0; j < RING_ENTRIES; j++) {
+			ring_submit(ring, RING_OP_NOP, 0, NULL, 0, j);
+		}
+		ring_enter(ring);
+		ring_reap(ring);
+	}
+	ms = time() - start;
+	n = snprintf(msg, sizeof(msg), "Task %d: %d batched ops in %d ms\n",
+		     pid, SYSCALL_LOOPS, ms);
+	write_all(msg, n);
+
+	/* a timeout posts its completion when it expires */
+	ring_submit(ring, RING_OP_TIMEOUT, 0, NULL, 3000, 0);
+	ring_enter(ring);
+
+	for (int i = 0; i < 3; i++) {
+		int done = ring->cq_tail - ring->cq_head;
+		ring_reap(ring);
+
+		/* print and sleep with a single syscall */
+		n = snprintf(msg, sizeof(msg), "Task %d: Running at %d ms, %d completions\n",
+			     pid, time(), done);
+		ring_submit(ring, RING_OP_WRITE, 1, msg, n, 1);
+		ring_submit(ring, RING_OP_SLEEP, 0, NULL, 2000, 2);
+		ring_enter(ring);
+	}
+	exit(0);
+}
+
+#ifdef CONFIG_PAGING
+/*
+ * The heap is allocated on demand, a page at a time when it is touched, and
+ * shared copy-on-write with the child after fork(), so the child sees the
+ * values of its parent until one of them writes the page.
+ */
+void user_task4(void *heap)
+{
+	int *counter = heap;
+	struct meminfo before, after;
+
+	*counter = 1;
+	meminfo(&before);
+	int child = fork();
+	if (child < 0) {
+		user_printf("Task %d: fork failed\n", getpid());
+		exit(-1);
 	}
+
+	if (0 == child) {
+		*counter += 100;
+		user_printf("Task %d: child, counter = %d\n", getpid(), *counter);
+	} else {
+		sleep(1000);
+		meminfo(&after);
+		/* the pages of the zero pool are there for the taking */
+		int used = before.free + before.zero_pool -
+			   after.free - after.zero_pool;
+		user_printf("Task %d: parent of %d, counter = %d, "
+			    "%d pages used since fork\n", getpid(), child,
+			    *counter, used);
+	}
+	exit(0);
 }
+#endif
+#endif
 
 /* NOTICE: DON'T LOOP INFINITELY IN main() */
 void os_main(void)
 {
 	task_create(user_task0);
 	task_create(user_task1);
+#ifdef CONFIG_SYSCALL
+	task_create(user_task2);
+	task_create((void (*)(void))user_task3);
+#ifdef CONFIG_PAGING
+	task_create((void (*)(void))user_task4);
+#endif
+#endif
 }
 
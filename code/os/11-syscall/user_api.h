@@ -1,7 +1,22 @@
 #ifndef __USER_API_H__
 #define __USER_API_H__
 
-/* user mode syscall APIs */
+struct sys_ring;
+struct meminfo;
+
+/* user mode syscall APIs, see SYSCALL_TABLE in syscall.h */
 extern int gethid(unsigned int *hid);
+extern int read(int fd, char *buf, int n);
+extern int write(int fd, const char *buf, int n);
+extern int sleep(unsigned int ms);
+extern int yield(void);
+extern void exit(int status);
+extern int getpid(void);
+extern unsigned int time(void);
+extern int ring_enter(struct sys_ring *ring);
+extern int fork(void);
+extern int meminfo(struct meminfo *info);
+extern int report(int what);
+extern int setlog(int what, unsigned int value);
 
 #endif /* __USER_API_H__ */
@@ -0,0 +1,315 @@
+#include "os.h"
+
+/*
+ * Sv32 page tables of tasks.
+ *
+ * The kernel still runs in Machine mode, which is never translated, so it
+ * needs no page table itself and keeps accessing the physical memory.
+ * Tasks run in User mode with their own page tables, see mm_setup() in
+ * sched.c, so the kernel translates the user addresses passed to syscalls
+ * by walking the page table of the task in software.
+ *
+ * A Sv32 page table has two levels, each is a page of 1024 PTEs, indexed by
+ * the 10-bit fields PX(1, va) and PX(0, va) of the virtual address.
+ *
+ * Pages of a task may be allocated on demand, and shared copy-on-write by
+ * task_fork(), which are marked with the two bits of a PTE reserved for
+ * software (RSW), and handled by uvm_fault() on page faults:
+ * - PTE_LAZY: an invalid PTE reserved by uvm_reserve(), the page is
+ *   allocated and zeroed when it is touched for the first time. The other
+ *   bits of the PTE keep the permissions of the page.
+ * - PTE_COW: a valid PTE of a page which was writable, but is shared by
+ *   uvm_share() read-only, it is copied when it is written.
+ *
+ * ref: https://github.com/mit-pdos/xv6-riscv/blob/riscv/kernel/vm.c
+ */
+
+#define PTE_LAZY (1 << 8)
+#define PTE_COW  (1 << 9)
+
+/* defined in usercopy.S */
+extern size_t __copy_user(void *dst, const void *src, size_t n);
+
+/*
+ * DESCRIPTION
+ * 	Create an empty page table.
+ * RETURN VALUE
+ * 	the page table, or NULL if out of memory.
+ */
+pagetable_t uvm_create(void)
+{
+	return page_alloc_zeroed(1);
+}
+
+/*
+ * DESCRIPTION
+ * 	Free the page table pt and drop a reference to each page mapped by
+ * 	it, see page_put(), the pages not from the page allocator, i.e. the
+ * 	kernel code and the stacks, are left alone.
+ * 	A page still shared with another task stays PTE_COW there, which
+ * 	just takes the page back on its next write fault, see uvm_fault().
+ */
+void uvm_free(pagetable_t pt)
+{
+	for (int i = 0; i < PAGE_SIZE / sizeof(pte_t); i++) {
+		/* skip megapages, which we never map */
+		if (!(pt[i] & PTE_V) || (pt[i] & (PTE_R | PTE_W | PTE_X))) {
+			continue;
+		}
+		pagetable_t leaf = (pagetable_t)PTE2PA(pt[i]);
+		for (int j = 0; j < PAGE_SIZE / sizeof(pte_t); j++) {
+			if (leaf[j] & PTE_V) {
+				page_put((void *)PTE2PA(leaf[j]));
+			}
+		}
+		page_free(leaf);
+	}
+	page_free(pt);
+}
+
+/*
+ * DESCRIPTION
+ * 	Find the PTE of the page of virtual address va, the second level page
+ * 	table is created if it doesn't exist yet and alloc is not 0.
+ * RETURN VALUE
+ * 	the address of the PTE, or NULL if not found.
+ */
+pte_t *uvm_walk(pagetable_t pt, reg_t va, int alloc)
+{
+	pte_t *pte = &pt[PX(1, va)];
+
+	if (*pte & PTE_V) {
+		if (*pte & (PTE_R | PTE_W | PTE_X)) {
+			/* a megapage, which we never map */
+			return NULL;
+		}
+		pt = (pagetable_t)PTE2PA(*pte);
+	} else {
+		if (!alloc || NULL == (pt = uvm_create())) {
+			return NULL;
+		}
+		/* a non-leaf PTE */
+		*pte = PA2PTE(pt) | PTE_V;
+	}
+	return &pt[PX(0, va)];
+}
+
+/*
+ * DESCRIPTION
+ * 	Map the virtual addresses [va, va + size) to the physical addresses
+ * 	starting at pa, va and pa must be page-aligned.
+ * 	- perm: PTE_R/W/X/U of the pages
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: out of memory, or the page has been mapped
+ */
+int uvm_map(pagetable_t pt, reg_t va, reg_t pa, reg_t size, int perm)
+{
+	for (reg_t off = 0; off < size; off += PAGE_SIZE) {
+		pte_t *pte = uvm_walk(pt, va + off, 1);
+		if (NULL == pte || (*pte & PTE_V)) {
+			return -1;
+		}
+		/*
+		 * set A and D in advance, hardware is allowed to raise a page
+		 * fault rather than set them for us.
+		 */
+		*pte = PA2PTE(pa + off) | perm | PTE_A | PTE_D | PTE_V;
+	}
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Reserve the virtual addresses [va, va + size) for pages allocated on
+ * 	demand, va must be page-aligned.
+ * 	- perm: PTE_R/W/X/U of the pages
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: out of memory, or the page has been mapped
+ */
+int uvm_reserve(pagetable_t pt, reg_t va, reg_t size, int perm)
+{
+	for (reg_t off = 0; off < size; off += PAGE_SIZE) {
+		pte_t *pte = uvm_walk(pt, va + off, 1);
+		if (NULL == pte || *pte) {
+			return -1;
+		}
+		*pte = perm | PTE_LAZY;
+	}
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Handle a page fault at the user virtual address va, by allocating
+ * 	the page on demand, or copying the page shared copy-on-write.
+ * 	- write: 1 if the fault is raised by a write
+ * RETURN VALUE
+ * 	0: fixed, the access can be retried
+ * 	-1: a bad access, or out of memory
+ */
+int uvm_fault(pagetable_t pt, reg_t va, int write)
+{
+	pte_t *pte = uvm_walk(pt, va, 0);
+	if (NULL == pte) {
+		return -1;
+	}
+
+	if (*pte & PTE_LAZY) {
+		void *page = page_alloc_zeroed(1);
+		if (NULL == page) {
+			return -1;
+		}
+		*pte = PA2PTE(page) | PTE_FLAGS(*pte & ~PTE_LAZY) |
+		       PTE_A | PTE_D | PTE_V;
+	} else if (write && (*pte & PTE_V) && (*pte & PTE_COW)) {
+		void *old = (void *)PTE2PA(*pte);
+		void *page = old;
+		if (page_shared(old)) {
+			page = page_alloc(1);
+			if (NULL == page) {
+				return -1;
+			}
+			memcpy(page, old, PAGE_SIZE);
+			page_put(old);
+		}
+		/* the last one sharing the page just takes it */
+		*pte = PA2PTE(page) | PTE_FLAGS(*pte & ~PTE_COW) | PTE_W;
+	} else {
+		return -1;
+	}
+
+	/* the invalid or read-only PTE may have been cached in the TLB */
+	sfence_vma(va);
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Share the pages of [va, va + size) in the page table src with dst,
+ * 	writable pages are shared copy-on-write, and the pages not allocated
+ * 	yet are reserved in dst as well. va must be page-aligned.
+ * RETURN VALUE
+ * 	0: success
+ * 	-1: out of memory
+ */
+int uvm_share(pagetable_t src, pagetable_t dst, reg_t va, reg_t size)
+{
+	for (reg_t off = 0; off < size; off += PAGE_SIZE) {
+		pte_t *from = uvm_walk(src, va + off, 0);
+		if (NULL == from || 0 == *from) {
+			continue;
+		}
+		pte_t *to = uvm_walk(dst, va + off, 1);
+		if (NULL == to) {
+			return -1;
+		}
+
+		if (*from & PTE_V) {
+			if (page_get((void *)PTE2PA(*from))) {
+				return -1;
+			}
+			if (*from & PTE_W) {
+				*from = (*from & ~PTE_W) | PTE_COW;
+				sfence_vma(va + off);
+			}
+		}
+		*to = *from;
+	}
+	return 0;
+}
+
+/*
+ * DESCRIPTION
+ * 	Translate a user virtual address va to the physical address.
+ * 	- perm: the PTE bits required besides PTE_V and PTE_U
+ * RETURN VALUE
+ * 	the physical address, or 0 if not mapped or not permitted.
+ */
+reg_t uvm_translate(pagetable_t pt, reg_t va, int perm)
+{
+	pte_t *pte = uvm_walk(pt, va, 0);
+	perm |= PTE_V | PTE_U;
+	if (NULL == pte || (*pte & perm) != perm) {
+		return 0;
+	}
+	return PTE2PA(*pte) | (va & (PAGE_SIZE - 1));
+}
+
+/*
+ * DESCRIPTION
+ * 	Get the physical address of the user buffer [va, va + n), which must
+ * 	not cross a page boundary, so it can be accessed directly. The page
+ * 	is allocated or copied now if it would be on a page fault.
+ * 	- write: 1 if the buffer will be written
+ * RETURN VALUE
+ * 	the physical address, or NULL if not mapped or not permitted.
+ */
+void *uvm_ptr(pagetable_t pt, reg_t va, size_t n, int write)
+{
+	int perm = write ? PTE_W : PTE_R;
+
+	if ((va & (PAGE_SIZE - 1)) + n > PAGE_SIZE) {
+		return NULL;
+	}
+	reg_t pa = uvm_translate(pt, va, perm);
+	if (0 == pa && 0 == uvm_fault(pt, va, write)) {
+		pa = uvm_translate(pt, va, perm);
+	}
+	return (void *)pa;
+}
+
+/*
+ * DESCRIPTION
+ * 	Copy between a kernel buffer and the user buffer at va, a page at a
+ * 	time, since contiguous virtual pages are not contiguous physically.
+ * 	- to_user: 1 to copy from kbuf to va, 0 to copy from va to kbuf
+ * RETURN VALUE
+ * 	number of bytes NOT copied, 0 on success.
+ */
+static size_t uvm_copy(pagetable_t pt, reg_t va, void *kbuf, size_t n, int to_user)
+{
+	int perm = to_user ? PTE_W : PTE_R;
+
+	while (n > 0) {
+		reg_t pa = uvm_translate(pt, va, perm);
+		if (0 == pa) {
+			/* the page may be allocated on demand, or copy-on-write */
+			if (uvm_fault(pt, va, to_user) ||
+			    0 == (pa = uvm_translate(pt, va, perm))) {
+				return n;
+			}
+		}
+
+		size_t len = PAGE_SIZE - (va & (PAGE_SIZE - 1));
+		if (len > n) {
+			len = n;
+		}
+
+		size_t left;
+		if (to_user) {
+			left = __copy_user((void *)pa, kbuf, len);
+		} else {
+			left = __copy_user(kbuf, (void *)pa, len);
+		}
+		if (left) {
+			return n - (len - left);
+		}
+
+		n -= len;
+		va += len;
+		kbuf = (uint8_t *)kbuf + len;
+	}
+	return 0;
+}
+
+size_t uvm_copyout(pagetable_t pt, reg_t dstva, const void *src, size_t n)
+{
+	return uvm_copy(pt, dstva, (void *)src, n, 1);
+}
+
+size_t uvm_copyin(pagetable_t pt, void *dst, reg_t srcva, size_t n)
+{
+	return uvm_copy(pt, srcva, dst, n, 0);
+}